@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// samples processed together by every stage before the next block is loaded
+constexpr int blockLength = 256;
+
+// sensor channels in output order
+enum channelIndex {
+  xAcc, yAcc, zAcc,
+  xAngle, yAngle, zAngle,
+  xRot, yRot, zRot,
+  channelCount
+};
+
+// one validity bit per sample, bit i % 64 of word i / 64
+using Mask = std::vector<uint64_t>;
+
+inline bool isSet(const Mask& mask, size_t i) {
+  return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+inline void setBit(Mask& mask, size_t i, bool value) {
+  mask[i / 64] = (mask[i / 64] & ~(uint64_t(1) << (i % 64))) | (uint64_t(value) << (i % 64));
+}
+
+// columnar chunk of the decoded stream, first channelCount columns are the sensor channels
+// values of samples without their valid bit set are unspecified
+class SampleBlock {
+public:
+  std::vector<int> t;
+  std::vector<std::string> names = {"xAcceleration", "yAcceleration", "zAcceleration",
+                                    "xAngle", "yAngle", "zAngle",
+                                    "xAngulearVelocity", "yAngularVelocity", "zAngularVelocity"};
+  std::vector<std::vector<double>> columns = std::vector<std::vector<double>>(channelCount);
+  std::vector<Mask> valid = std::vector<Mask>(channelCount);
+
+  size_t size() const {
+    return t.size();
+  }
+
+  void resize(size_t n) {
+    t.resize(n);
+    for(auto& column : columns) {
+      column.resize(n);
+    }
+    for(auto& mask : valid) {
+      mask.resize(words());
+      // no valid bits past the end
+      if(n % 64) {
+        mask.back() &= (uint64_t(1) << (n % 64)) - 1;
+      }
+    }
+  }
+
+  size_t words() const {
+    return (size() + 63) / 64;
+  }
+
+  // index of a named column, -1 if there is none
+  int find(const std::string& name) const {
+    for(size_t i = 0; i < names.size(); ++i) {
+      if(names[i] == name) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // index of a named column, appended if it doesn't exist yet
+  int column(const std::string& name) {
+    if(find(name) >= 0) {
+      return find(name);
+    }
+    names.push_back(name);
+    columns.emplace_back(size());
+    valid.emplace_back(words());
+    return names.size() - 1;
+  }
+};
+
+class Stage {
+public:
+  virtual void process(SampleBlock& block) = 0;
+  // called once after the last block, e.g. to complete open tables
+  virtual void finish() {
+  }
+  virtual ~Stage() = default;
+};
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "filters.hpp"
+#include "statistics.hpp"
+
+// attributes in column order: acceleration, angle, rotation velocity
+constexpr int attributeCount = 3;
+constexpr const char* attributeNames[attributeCount] = {"acceleration", "angle", "rotationVelocity"};
+
+// calibrated = (nominal - bias - drift) * scale per axis, in the units of the attribute; drift is the
+// rotation velocity bias change with the sensor temperature,
+// drift = (linear + quadratic * (temp - reference)) * (temp - reference)
+struct Calibration {
+  double bias[attributeCount][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  double scale[attributeCount][3] = {{1, 1, 1}, {1, 1, 1}, {1, 1, 1}};
+  bool temperatureCompensation = false;
+  double referenceTemperature = 0;  // deg C
+  double drift[2][3] = {{0, 0, 0}, {0, 0, 0}};  // linear, quadratic
+  // sensor to racket frame rotation applied to calibrated acceleration and rotation velocity, row major
+  bool mounted = false;
+  double mounting[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+};
+
+// one line per attribute: name, x/y/z bias, x/y/z scale, and with temperature compensation a drift
+// line: reference temperature, x/y/z linear, x/y/z quadratic coefficient, and with a mounting rotation
+// its matrix row by row
+inline bool writeCalibration(const std::string& file, const Calibration& calibration) {
+  std::ofstream output(file);
+  output << "#attribute,xBias,yBias,zBias,xScale,yScale,zScale" << std::endl;
+  output.precision(17);
+  for(int a = 0; a < attributeCount; ++a) {
+    output << attributeNames[a];
+    for(double bias : calibration.bias[a]) {
+      output << "\t" << bias;
+    }
+    for(double scale : calibration.scale[a]) {
+      output << "\t" << scale;
+    }
+    output << "\n";
+  }
+  if(calibration.temperatureCompensation) {
+    output << "rotationVelocityDrift\t" << calibration.referenceTemperature;
+    for(const auto& coefficients : calibration.drift) {
+      for(double c : coefficients) {
+        output << "\t" << c;
+      }
+    }
+    output << "\n";
+  }
+  if(calibration.mounted) {
+    output << "mounting";
+    for(double m : calibration.mounting) {
+      output << "\t" << m;
+    }
+    output << "\n";
+  }
+  return output.good();
+}
+
+inline bool readCalibration(const std::string& file, Calibration& calibration) {
+  std::ifstream input(file);
+  if(!input.good()) {
+    return false;
+  }
+  std::string line;
+  while(std::getline(input, line)) {
+    if(line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream values(line);
+    std::string name;
+    values >> name;
+    if(name == "rotationVelocityDrift") {
+      values >> calibration.referenceTemperature;
+      for(auto& coefficients : calibration.drift) {
+        for(double& c : coefficients) {
+          values >> c;
+        }
+      }
+      calibration.temperatureCompensation = true;
+      if(!values) {
+        return false;
+      }
+      continue;
+    }
+    if(name == "mounting") {
+      for(double& m : calibration.mounting) {
+        values >> m;
+      }
+      calibration.mounted = true;
+      if(!values) {
+        return false;
+      }
+      continue;
+    }
+    auto a = std::find(attributeNames, attributeNames + attributeCount, name) - attributeNames;
+    if(a == attributeCount) {
+      return false;
+    }
+    for(double& bias : calibration.bias[a]) {
+      values >> bias;
+    }
+    for(double& scale : calibration.scale[a]) {
+      values >> scale;
+    }
+    if(!values) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// solves the n x n system a x = b in place by gauss jordan elimination with partial pivoting, false if
+// it is singular
+inline bool solve(std::vector<double>& a, std::vector<double>& b, int n) {
+  for(int c = 0; c < n; ++c) {
+    int pivot = c;
+    for(int r = c + 1; r < n; ++r) {
+      pivot = std::fabs(a[r * n + c]) > std::fabs(a[pivot * n + c]) ? r : pivot;
+    }
+    if(std::fabs(a[pivot * n + c]) < 1e-12) {
+      return false;
+    }
+    for(int k = 0; k < n; ++k) {
+      std::swap(a[c * n + k], a[pivot * n + k]);
+    }
+    std::swap(b[c], b[pivot]);
+    for(int r = 0; r < n; ++r) {
+      if(r != c) {
+        double f = a[r * n + c] / a[c * n + c];
+        for(int k = 0; k < n; ++k) {
+          a[r * n + k] -= f * a[c * n + k];
+        }
+        b[r] -= f * b[c];
+      }
+    }
+  }
+  for(int c = 0; c < n; ++c) {
+    b[c] /= a[c * n + c];
+  }
+  return true;
+}
+
+// static period means whose gravity directions differ by more than maxAngle (deg) from each other
+inline size_t distinctOrientations(const std::vector<Vec3>& means, double maxAngle = 30) {
+  std::vector<Vec3> directions;
+  double minCos = std::cos(maxAngle * M_PI / 180);
+  for(const Vec3& mean : means) {
+    double norm = std::sqrt(squaredNorm(mean));
+    if(norm == 0) {
+      continue;
+    }
+    Vec3 direction = (1 / norm) * mean;
+    bool known = false;
+    for(const Vec3& d : directions) {
+      known |= d.x * direction.x + d.y * direction.y + d.z * direction.z > minCos;
+    }
+    if(!known) {
+      directions.push_back(direction);
+    }
+  }
+  return directions.size();
+}
+
+// bias and scale per axis so the static acceleration means have a magnitude of 1 g, by levenberg
+// marquardt on (|scale * (mean - bias)|^2 - 1); needs static periods in six distinct orientations, with
+// fewer (or if the fit is off) only a common scale is estimated; false if even that is off nominal by
+// more than a factor of 2, the sensor or its decoding is broken then
+inline bool fitAccelerometer(const std::vector<Vec3>& means, double* bias, double* scale) {
+  double norm = 0;
+  for(const Vec3& mean : means) {
+    norm += std::sqrt(squaredNorm(mean)) / means.size();
+  }
+  if(!(norm > 0.5 && norm < 2)) {
+    return false;
+  }
+  std::fill(bias, bias + 3, 0.);
+  std::fill(scale, scale + 3, 1 / norm);
+  if(distinctOrientations(means) < 6) {
+    return true;
+  }
+
+  double p[6] = {0, 0, 0, scale[0], scale[1], scale[2]};  // bias, scale
+  double damping = 1e-3;
+  auto cost = [&](const double* q) {
+    double sum = 0;
+    for(const Vec3& mean : means) {
+      double m[3] = {mean.x, mean.y, mean.z}, r = -1;
+      for(int a = 0; a < 3; ++a) {
+        r += q[3 + a] * q[3 + a] * (m[a] - q[a]) * (m[a] - q[a]);
+      }
+      sum += r * r;
+    }
+    return sum;
+  };
+  for(int iteration = 0; iteration < 100; ++iteration) {
+    std::vector<double> jtj(36, 0), jtr(6, 0);
+    for(const Vec3& mean : means) {
+      double m[3] = {mean.x, mean.y, mean.z}, r = -1, j[6];
+      for(int a = 0; a < 3; ++a) {
+        double d = m[a] - p[a];
+        r += p[3 + a] * p[3 + a] * d * d;
+        j[a] = -2 * p[3 + a] * p[3 + a] * d;
+        j[3 + a] = 2 * p[3 + a] * d * d;
+      }
+      for(int k = 0; k < 6; ++k) {
+        jtr[k] -= j[k] * r;
+        for(int l = 0; l < 6; ++l) {
+          jtj[k * 6 + l] += j[k] * j[l];
+        }
+      }
+    }
+    for(int k = 0; k < 6; ++k) {
+      jtj[k * 6 + k] *= 1 + damping;
+    }
+    if(!solve(jtj, jtr, 6)) {
+      return true;
+    }
+    double q[6];
+    for(int k = 0; k < 6; ++k) {
+      q[k] = p[k] + jtr[k];
+    }
+    if(cost(q) < cost(p)) {
+      std::copy(q, q + 6, p);
+      damping /= 10;
+    } else {
+      damping *= 10;
+    }
+  }
+  // a scale far off nominal means the orientations didn't constrain the fit
+  for(int a = 0; a < 3; ++a) {
+    if(!(std::fabs(p[3 + a]) > 0.5 && std::fabs(p[3 + a]) < 2)) {
+      return true;
+    }
+  }
+  for(int a = 0; a < 3; ++a) {
+    bias[a] = p[a];
+    scale[a] = std::fabs(p[3 + a]);
+  }
+  return true;
+}
+
+// least squares fit of the static rotation velocity to bias + drift over temperature, quadratic if the
+// temperatures span at least minSpan deg C; false if they span less than a tenth of that, too little to
+// tell drift from noise
+inline bool fitTemperatureDrift(const std::vector<double>& temperatures, const std::vector<Vec3>& rotations,
+                                double minSpan, Calibration& calibration) {
+  if(temperatures.empty()) {
+    return false;
+  }
+  auto range = std::minmax_element(temperatures.begin(), temperatures.end());
+  double span = *range.second - *range.first;
+  if(!(span >= minSpan / 10)) {
+    return false;
+  }
+  int terms = span >= minSpan ? 3 : 2;
+  double reference = 0;
+  for(double temperature : temperatures) {
+    reference += temperature / temperatures.size();
+  }
+  for(int axis = 0; axis < 3; ++axis) {
+    std::vector<double> normal(terms * terms, 0), right(terms, 0);
+    for(size_t i = 0; i < temperatures.size(); ++i) {
+      double d = temperatures[i] - reference, basis[3] = {1, d, d * d};
+      double rotation[3] = {rotations[i].x, rotations[i].y, rotations[i].z};
+      for(int k = 0; k < terms; ++k) {
+        right[k] += basis[k] * rotation[axis];
+        for(int l = 0; l < terms; ++l) {
+          normal[k * terms + l] += basis[k] * basis[l];
+        }
+      }
+    }
+    if(!solve(normal, right, terms)) {
+      return false;
+    }
+    calibration.bias[2][axis] = right[0];
+    calibration.drift[0][axis] = right[1];
+    calibration.drift[1][axis] = terms == 3 ? right[2] : 0;
+  }
+  calibration.temperatureCompensation = true;
+  calibration.referenceTemperature = reference;
+  return true;
+}
+
+// finds static periods, where the variance of the acceleration magnitude (g^2) and of the rotation
+// velocity magnitude ((deg/s)^2) stayed below their maximum over the last window samples, and
+// estimates a calibration from them: the rotation velocity bias as its mean while static, the
+// acceleration bias and scale from the mean of every static period of at least window samples; if the
+// blocks carry a temperature column the rotation velocity bias is fitted over temperature instead
+class CalibrationStage : public Stage {
+  RollingStatistics<2> motion;  // acceleration magnitude, rotation velocity magnitude
+  double maxAccelerationVariance, maxRotationVariance;
+  size_t window;
+
+  bool wasStatic = false;
+  size_t periodLength = 0;
+  Vec3 periodAcceleration = {0, 0, 0};
+  std::vector<Vec3> periodMeans;
+  Vec3 rotationSum = {0, 0, 0};
+  size_t staticSamples = 0;
+  int temperatureColumn = -2;  // -1 without one
+  std::vector<double> temperatures;
+  std::vector<Vec3> staticRotations;
+
+  void endPeriod() {
+    if(periodLength >= window) {
+      periodMeans.push_back((1. / periodLength) * periodAcceleration);
+    }
+    periodLength = 0;
+    periodAcceleration = {0, 0, 0};
+  }
+
+public:
+  CalibrationStage(double maxAccelerationVariance_, double maxRotationVariance_, size_t window_)
+      : motion(window_),
+        maxAccelerationVariance(maxAccelerationVariance_),
+        maxRotationVariance(maxRotationVariance_),
+        window(window_) {
+  }
+
+  void process(SampleBlock& block) override {
+    if(temperatureColumn == -2) {
+      temperatureColumn = block.find("temperature");
+    }
+    for(size_t i = 0; i < block.size(); ++i) {
+      bool valid[2];
+      valid[0] = isSet(block.valid[xAcc], i) && isSet(block.valid[yAcc], i) && isSet(block.valid[zAcc], i);
+      valid[1] = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      Vec3 acceleration = {block.columns[xAcc][i], block.columns[yAcc][i], block.columns[zAcc][i]};
+      Vec3 rotation = {block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]};
+      double x[2] = {std::sqrt(squaredNorm(acceleration)), std::sqrt(squaredNorm(rotation))};
+      motion.push(x, valid);
+      bool isStatic = valid[0] && valid[1] && motion.count(0) >= window / 2 && motion.count(1) >= window / 2 &&
+                      motion.variance(0) < maxAccelerationVariance && motion.variance(1) < maxRotationVariance;
+      if(isStatic) {
+        ++periodLength;
+        periodAcceleration = periodAcceleration + acceleration;
+        rotationSum = rotationSum + rotation;
+        ++staticSamples;
+        if(temperatureColumn >= 0 && isSet(block.valid[temperatureColumn], i)) {
+          temperatures.push_back(block.columns[temperatureColumn][i]);
+          staticRotations.push_back(rotation);
+        }
+      } else if(wasStatic) {
+        endPeriod();
+      }
+      wasStatic = isStatic;
+    }
+  }
+
+  void finish() override {
+    endPeriod();
+  }
+
+  // false if there was no static period or its acceleration was implausible, error tells which
+  bool estimate(Calibration& calibration, std::string& error) const {
+    if(periodMeans.empty()) {
+      error = "No static period found!";
+      return false;
+    }
+    if(!fitAccelerometer(periodMeans, calibration.bias[0], calibration.scale[0])) {
+      error = "Implausible acceleration scale, static periods don't read about 1 g!";
+      return false;
+    }
+    Vec3 rotationBias = (1. / staticSamples) * rotationSum;
+    calibration.bias[2][0] = rotationBias.x;
+    calibration.bias[2][1] = rotationBias.y;
+    calibration.bias[2][2] = rotationBias.z;
+    fitTemperatureDrift(temperatures, staticRotations, 5, calibration);
+    return true;
+  }
+};
+
+// estimates the mounting rotation from a calibration motion turning the racket around its handle: the
+// dominant eigenvector of the rotation velocities above minRotation (deg/s) is the handle axis in the
+// sensor frame, the mounting is the smallest rotation taking it onto the racket x axis
+class MountingStage : public Stage {
+  double minRotation;
+  double moments[9] = {0};  // sum of w w^T
+  size_t samples = 0;
+
+public:
+  MountingStage(double minRotation_) : minRotation(minRotation_) {
+  }
+
+  void process(SampleBlock& block) override {
+    for(size_t i = 0; i < block.size(); ++i) {
+      bool valid = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      double w[3] = {block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]};
+      if(!valid || w[0] * w[0] + w[1] * w[1] + w[2] * w[2] < minRotation * minRotation) {
+        continue;
+      }
+      for(int r = 0; r < 3; ++r) {
+        for(int c = 0; c < 3; ++c) {
+          moments[3 * r + c] += w[r] * w[c];
+        }
+      }
+      ++samples;
+    }
+  }
+
+  // false if the motion had no clear rotation axis, the dominant eigenvalue not above the other two combined
+  bool estimate(Calibration& calibration) const {
+    if(samples == 0) {
+      return false;
+    }
+    // power iteration from the column of the largest diagonal element
+    int largest = moments[0] >= moments[4] && moments[0] >= moments[8] ? 0 : moments[4] >= moments[8] ? 1 : 2;
+    double axis[3] = {moments[largest], moments[3 + largest], moments[6 + largest]}, eigenvalue = 0;
+    for(int iteration = 0; iteration < 100; ++iteration) {
+      double next[3] = {0, 0, 0};
+      for(int r = 0; r < 3; ++r) {
+        for(int c = 0; c < 3; ++c) {
+          next[r] += moments[3 * r + c] * axis[c];
+        }
+      }
+      eigenvalue = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+      if(eigenvalue == 0) {
+        return false;
+      }
+      for(int k = 0; k < 3; ++k) {
+        axis[k] = next[k] / eigenvalue;
+      }
+    }
+    // the other two eigenvalues sum to the rest of the trace
+    double rest = moments[0] + moments[4] + moments[8] - eigenvalue;
+    if(eigenvalue <= rest) {
+      return false;
+    }
+    // turning either way is the same axis, take the direction nearest to x
+    double sign = axis[0] < 0 ? -1 : 1;
+    Vec3 a = {sign * axis[0], sign * axis[1], sign * axis[2]};
+    // rodrigues with v = a x e_x and cos = a . e_x: R = I + [v]x + [v]x^2 / (1 + cos)
+    Vec3 v = {0, a.z, -a.y};
+    double cos = a.x, f = 1 / (1 + cos);
+    double r[9] = {1 - f * (v.y * v.y + v.z * v.z), -v.z + f * v.x * v.y, v.y + f * v.x * v.z,
+                   v.z + f * v.x * v.y, 1 - f * (v.x * v.x + v.z * v.z), -v.x + f * v.y * v.z,
+                   -v.y + f * v.x * v.z, v.x + f * v.y * v.z, 1 - f * (v.x * v.x + v.y * v.y)};
+    std::copy(r, r + 9, calibration.mounting);
+    calibration.mounted = true;
+    return true;
+  }
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "segmentation.hpp"
+
+// strokes are compared as their rotation velocity over time, resampled to a fixed length and z
+// normalized per axis, so dtw compares shape independent of duration and amplitude
+constexpr int shapeLength = 64;
+constexpr int shapeChannels = 3;
+
+struct StrokeShape {
+  std::string label;
+  double v[shapeChannels][shapeLength];
+};
+
+inline StrokeShape makeShape(const std::vector<Vec3>& samples, const std::string& label = "") {
+  StrokeShape shape;
+  shape.label = label;
+  size_t n = samples.size();
+  for(int i = 0; i < shapeLength; ++i) {
+    double position = n > 1 ? (double) i * (n - 1) / (shapeLength - 1) : 0;
+    size_t below = std::min((size_t) position, n - 1);
+    size_t above = std::min(below + 1, n - 1);
+    double f = position - below;
+    Vec3 v = (1 - f) * samples[below] + f * samples[above];
+    shape.v[0][i] = v.x;
+    shape.v[1][i] = v.y;
+    shape.v[2][i] = v.z;
+  }
+  for(auto& channel : shape.v) {
+    double mean = std::accumulate(channel, channel + shapeLength, 0.) / shapeLength;
+    double squares = 0;
+    for(double x : channel) {
+      squares += (x - mean) * (x - mean);
+    }
+    double deviation = std::sqrt(squares / shapeLength);
+    for(double& x : channel) {
+      x = deviation > 0 ? (x - mean) / deviation : 0;
+    }
+  }
+  return shape;
+}
+
+// one shape per line: label followed by the values channel by channel
+inline void writeShape(std::ostream& output, const StrokeShape& shape) {
+  output << shape.label;
+  for(const auto& channel : shape.v) {
+    for(double x : channel) {
+      output << "\t" << x;
+    }
+  }
+  output << "\n";
+}
+
+inline bool readShapes(const std::string& file, std::vector<StrokeShape>& shapes) {
+  std::ifstream input(file);
+  if(!input.good()) {
+    return false;
+  }
+  std::string line;
+  while(std::getline(input, line)) {
+    if(line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream values(line);
+    StrokeShape shape;
+    values >> shape.label;
+    for(auto& channel : shape.v) {
+      for(double& x : channel) {
+        values >> x;
+      }
+    }
+    if(!values) {
+      return false;
+    }
+    shapes.push_back(shape);
+  }
+  return true;
+}
+
+// nearest neighbour under dtw with a sakoe chiba band; candidates are pruned with LB_Kim (first and
+// last point) and LB_Keogh (distance to the band envelope of the template), and the lower bound and dtw
+// computations abandon as soon as they exceed the best distance so far
+class DtwClassifier {
+  struct Template {
+    StrokeShape shape;
+    double upper[shapeChannels][shapeLength], lower[shapeChannels][shapeLength];
+  };
+  std::vector<Template> templates;
+  int band;
+
+  static double lbKim(const StrokeShape& a, const StrokeShape& b) {
+    double bound = 0;
+    for(int c = 0; c < shapeChannels; ++c) {
+      double first = a.v[c][0] - b.v[c][0];
+      double last = a.v[c][shapeLength - 1] - b.v[c][shapeLength - 1];
+      bound += first * first + last * last;
+    }
+    return bound;
+  }
+
+  static double lbKeogh(const StrokeShape& query, const Template& t, double best) {
+    double bound = 0;
+    for(int c = 0; c < shapeChannels && bound < best; ++c) {
+      const double* q = query.v[c];
+      const double* upper = t.upper[c];
+      const double* lower = t.lower[c];
+      for(int i = 0; i < shapeLength; ++i) {
+        double above = std::max(q[i] - upper[i], 0.);
+        double below = std::max(lower[i] - q[i], 0.);
+        bound += above * above + below * below;
+      }
+    }
+    return bound;
+  }
+
+  double dtw(const StrokeShape& a, const StrokeShape& b, double best) const {
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+    double previous[shapeLength + 1], current[shapeLength + 1], local[shapeLength];
+    std::fill(previous, previous + shapeLength + 1, infinity);
+    previous[0] = 0;
+    for(int i = 0; i < shapeLength; ++i) {
+      int from = std::max(0, i - band), to = std::min(shapeLength - 1, i + band);
+      // local distances of the row first, independent of each other
+      for(int j = from; j <= to; ++j) {
+        local[j] = 0;
+      }
+      for(int c = 0; c < shapeChannels; ++c) {
+        for(int j = from; j <= to; ++j) {
+          double d = a.v[c][i] - b.v[c][j];
+          local[j] += d * d;
+        }
+      }
+      std::fill(current, current + shapeLength + 1, infinity);
+      double rowMinimum = infinity;
+      for(int j = from; j <= to; ++j) {
+        current[j + 1] = local[j] + std::min({previous[j], previous[j + 1], current[j]});
+        rowMinimum = std::min(rowMinimum, current[j + 1]);
+      }
+      if(rowMinimum >= best) {
+        return infinity;
+      }
+      std::copy(current, current + shapeLength + 1, previous);
+      previous[0] = infinity;
+    }
+    return previous[shapeLength];
+  }
+
+public:
+  DtwClassifier(const std::vector<StrokeShape>& shapes, int band_) : band(band_) {
+    for(const auto& shape : shapes) {
+      Template t;
+      t.shape = shape;
+      for(int c = 0; c < shapeChannels; ++c) {
+        for(int i = 0; i < shapeLength; ++i) {
+          int from = std::max(0, i - band), to = std::min(shapeLength - 1, i + band);
+          t.upper[c][i] = *std::max_element(shape.v[c] + from, shape.v[c] + to + 1);
+          t.lower[c][i] = *std::min_element(shape.v[c] + from, shape.v[c] + to + 1);
+        }
+      }
+      templates.push_back(t);
+    }
+  }
+
+  size_t size() const {
+    return templates.size();
+  }
+
+  // nearest template or nullptr if there are none
+  const StrokeShape* classify(const StrokeShape& query, double& distance) const {
+    std::vector<std::pair<double, size_t>> candidates;
+    for(size_t k = 0; k < templates.size(); ++k) {
+      candidates.emplace_back(lbKim(query, templates[k].shape), k);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    const StrokeShape* nearest = nullptr;
+    distance = std::numeric_limits<double>::infinity();
+    for(const auto& candidate : candidates) {
+      if(candidate.first >= distance) {
+        break;
+      }
+      const Template& t = templates[candidate.second];
+      if(lbKeogh(query, t, distance) >= distance) {
+        continue;
+      }
+      double d = dtw(query, t.shape, distance);
+      if(d < distance) {
+        distance = d;
+        nearest = &t.shape;
+      }
+    }
+    return nearest;
+  }
+};
+
+// segments strokes like StrokeSegmentationStage and hands the shape of every completed one to done()
+class StrokeShapeStage : public Stage {
+  StrokeDetector detector;
+  std::vector<Vec3> samples;
+  Vec3 lastValid = {0, 0, 0};
+
+protected:
+  virtual void done(const Stroke& stroke, const StrokeShape& shape) = 0;
+
+public:
+  StrokeShapeStage(double startThreshold, double endThreshold) : detector(startThreshold, endThreshold, 3) {
+  }
+
+  void process(SampleBlock& block) override {
+    for(size_t i = 0; i < block.size(); ++i) {
+      bool valid = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      Vec3 rotation = {block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]};
+      lastValid = valid ? rotation : lastValid;
+      Stroke stroke;
+      bool completed = detector.push(block.t[i], std::sqrt(squaredNorm(rotation)), valid, stroke);
+      if(detector.isInStroke() || completed) {
+        samples.push_back(lastValid);
+      }
+      if(completed) {
+        done(stroke, makeShape(samples));
+      }
+      if(!detector.isInStroke()) {
+        samples.clear();
+      }
+    }
+  }
+
+  void finish() override {
+    Stroke stroke;
+    if(detector.finish(stroke)) {
+      done(stroke, makeShape(samples));
+    }
+    samples.clear();
+  }
+};
+
+// writes the shape of every stroke labeled with the name of the recording, input for classify
+class TemplateStage : public StrokeShapeStage {
+  std::string label;
+  std::ofstream table;
+
+  void done(const Stroke&, const StrokeShape& shape) override {
+    StrokeShape labeled = shape;
+    labeled.label = label;
+    writeShape(table, labeled);
+  }
+
+public:
+  TemplateStage(const std::string& tableFile, const std::string& label_, double startThreshold, double endThreshold)
+      : StrokeShapeStage(startThreshold, endThreshold), label(label_), table(tableFile) {
+    table << "#label,shape" << std::endl;
+  }
+};
+
+// labels every stroke with its nearest template
+class ClassifyStage : public StrokeShapeStage {
+  DtwClassifier classifier;
+  std::ofstream table;
+  int strokes = 0;
+
+  void done(const Stroke& stroke, const StrokeShape& shape) override {
+    double distance;
+    const StrokeShape* nearest = classifier.classify(shape, distance);
+    table << strokes++ << "\t" << stroke.start << "\t" << stroke.end << "\t" << (nearest ? nearest->label : "none")
+          << "\t" << distance << "\n";
+  }
+
+public:
+  ClassifyStage(const std::string& tableFile, const DtwClassifier& classifier_, double startThreshold, double endThreshold)
+      : StrokeShapeStage(startThreshold, endThreshold), classifier(classifier_), table(tableFile) {
+    table << "#stroke,start,end,label,distance" << std::endl;
+  }
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#include "block.hpp"
+#include "filters.hpp"
+
+struct Fall {
+  int start, impact;  // t of the first free fall sample and of the impact
+  int freeFallLength;  // samples
+  double impactAcceleration;  // g
+};
+
+// online drop detection: at least minFreeFall samples with an acceleration magnitude below the free fall
+// threshold, followed within maxGap samples by one above the impact threshold; the fall is reported on
+// the impact sample itself, magnitudes are compared squared so no sample needs a square root; the
+// thresholds are absolute and assume acceleration in g reading about 1 g at rest, as all recordings in
+// mes/ do: none of them drops below the default 0.3 g outside the drop in multi_falls.dat
+class FallDetector {
+  double freeFallSquared, impactSquared;
+  int minFreeFall, maxGap;
+  int freeFallStart = 0, freeFallLength = 0;  // of the current run below the free fall threshold
+  int gap = -1;  // samples since a long enough free fall ended, -1 if there was none
+  Fall current;
+
+public:
+  FallDetector(double freeFall, double impact, int minFreeFall_, int maxGap_)
+      : freeFallSquared(freeFall * freeFall), impactSquared(impact * impact), minFreeFall(minFreeFall_), maxGap(maxGap_) {
+  }
+
+  // returns true on an impact after a free fall, it is stored in fall; invalid samples are skipped
+  bool push(int t, const Vec3& acceleration, bool valid, Fall& fall) {
+    if(!valid) {
+      return false;
+    }
+    double squared = squaredNorm(acceleration);
+    if(squared < freeFallSquared) {
+      if(freeFallLength++ == 0) {
+        freeFallStart = t;
+      }
+      return false;
+    }
+    if(freeFallLength >= minFreeFall) {
+      current.start = freeFallStart;
+      current.freeFallLength = freeFallLength;
+      gap = 0;
+    }
+    freeFallLength = 0;
+    if(gap < 0) {
+      return false;
+    }
+    if(squared > impactSquared) {
+      gap = -1;
+      fall = current;
+      fall.impact = t;
+      fall.impactAcceleration = std::sqrt(squared);
+      return true;
+    }
+    if(++gap > maxGap) {
+      gap = -1;
+    }
+    return false;
+  }
+};
+
+// writes every free fall followed by an impact to the table as soon as the impact sample arrives
+class FallStage : public Stage {
+  FallDetector detector;
+  std::ofstream table;
+  int falls = 0;
+
+public:
+  FallStage(const std::string& tableFile, double freeFall, double impact, int minFreeFall, int maxGap)
+      : detector(freeFall, impact, minFreeFall, maxGap), table(tableFile) {
+    table << "#fall,freeFallStart,impact,freeFallSamples,impactAcceleration" << std::endl;
+  }
+
+  void process(SampleBlock& block) override {
+    for(size_t i = 0; i < block.size(); ++i) {
+      bool valid = isSet(block.valid[xAcc], i) && isSet(block.valid[yAcc], i) && isSet(block.valid[zAcc], i);
+      Fall fall;
+      if(detector.push(block.t[i], Vec3{block.columns[xAcc][i], block.columns[yAcc][i], block.columns[zAcc][i]},
+                       valid, fall)) {
+        // falls are rare, flushing each one keeps the latency down for live decoding
+        table << falls++ << "\t" << fall.start << "\t" << fall.impact << "\t" << fall.freeFallLength << "\t"
+              << fall.impactAcceleration << std::endl;
+      }
+    }
+  }
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "filters.hpp"
+#include "orientation.hpp"
+#include "parallel.hpp"
+#include "segmentation.hpp"
+
+// fixed feature vector of a stroke, the order of featureNames
+constexpr int featureCount = 12;
+constexpr const char* featureNames[featureCount] = {
+    "duration",         "peakRotationVelocity", "meanRotationVelocity", "peakLinearAcceleration",
+    "xAngleRange",      "yAngleRange",          "zAngleRange",          "meanJerk",
+    "peakJerk",         "rmsJerk",              "energy",               "rotationEnergy"};
+
+// one record of the binary feature table, written as is after a FeatureHeader
+struct StrokeFeatures {
+  int32_t stroke, start, end;  // start and end are t
+  float v[featureCount];
+};
+static_assert(sizeof(StrokeFeatures) == 3 * 4 + featureCount * 4, "feature records must not be padded");
+
+struct FeatureHeader {
+  char magic[4] = {'t', 't', 'f', '1'};
+  uint32_t featureCount = ::featureCount;
+};
+
+// stroke of an archive feature table
+struct ArchiveStroke {
+  uint32_t file;  // index into the archive files
+  StrokeFeatures features;
+};
+
+// z normalization of the features over a set of strokes so each feature counts the same in distances
+struct FeatureNormalization {
+  float mean[featureCount], scale[featureCount];
+
+  FeatureNormalization(const std::vector<ArchiveStroke>& strokes) {
+    for(int f = 0; f < featureCount; ++f) {
+      double sum = 0, squares = 0;
+      for(const auto& stroke : strokes) {
+        sum += stroke.features.v[f];
+        squares += (double) stroke.features.v[f] * stroke.features.v[f];
+      }
+      double n = std::max(strokes.size(), (size_t) 1);
+      double variance = squares / n - (sum / n) * (sum / n);
+      mean[f] = sum / n;
+      scale[f] = variance > 0 ? 1 / std::sqrt(variance) : 1;
+    }
+  }
+
+  void apply(const float* features, float* normalized) const {
+    for(int f = 0; f < featureCount; ++f) {
+      normalized[f] = (features[f] - mean[f]) * scale[f];
+    }
+  }
+
+  void invert(const float* normalized, float* features) const {
+    for(int f = 0; f < featureCount; ++f) {
+      features[f] = normalized[f] / scale[f] + mean[f];
+    }
+  }
+};
+
+// samples of one stroke, invalid ones replaced by the last valid value
+struct StrokeSamples {
+  Stroke stroke;
+  std::vector<Vec3> rotation, linearAcceleration, angle;
+};
+
+// duration (s), rotation velocity (deg/s), linear acceleration (g), angle range (deg), jerk as the
+// change of linear acceleration (g/s), energy as the integral of the squared linear acceleration (g^2 s)
+// and rotation energy of the squared rotation velocity ((deg/s)^2 s)
+inline void strokeFeatures(const StrokeSamples& samples, double sampleRate, float* features) {
+  size_t n = samples.rotation.size();
+  double dt = 1 / sampleRate;
+  double peakRotation = 0, sumRotation = 0, rotationEnergy = 0, peakLinear = 0, energy = 0;
+  for(size_t i = 0; i < n; ++i) {
+    double rotationSquared = squaredNorm(samples.rotation[i]);
+    double linearSquared = squaredNorm(samples.linearAcceleration[i]);
+    peakRotation = std::max(peakRotation, rotationSquared);
+    sumRotation += std::sqrt(rotationSquared);
+    rotationEnergy += rotationSquared * dt;
+    peakLinear = std::max(peakLinear, linearSquared);
+    energy += linearSquared * dt;
+  }
+
+  Vec3 minimum = samples.angle[0], maximum = samples.angle[0];
+  for(const Vec3& angle : samples.angle) {
+    minimum = {std::min(minimum.x, angle.x), std::min(minimum.y, angle.y), std::min(minimum.z, angle.z)};
+    maximum = {std::max(maximum.x, angle.x), std::max(maximum.y, angle.y), std::max(maximum.z, angle.z)};
+  }
+
+  double sumJerk = 0, sumJerkSquared = 0, peakJerk = 0;
+  for(size_t i = 1; i < n; ++i) {
+    double jerkSquared = squaredNorm(sampleRate * (samples.linearAcceleration[i] - samples.linearAcceleration[i - 1]));
+    sumJerk += std::sqrt(jerkSquared);
+    sumJerkSquared += jerkSquared;
+    peakJerk = std::max(peakJerk, jerkSquared);
+  }
+  size_t differences = std::max(n, (size_t) 2) - 1;
+
+  double values[featureCount] = {n * dt,
+                                 std::sqrt(peakRotation),
+                                 sumRotation / n,
+                                 std::sqrt(peakLinear),
+                                 maximum.x - minimum.x,
+                                 maximum.y - minimum.y,
+                                 maximum.z - minimum.z,
+                                 sumJerk / differences,
+                                 std::sqrt(peakJerk),
+                                 std::sqrt(sumJerkSquared / differences),
+                                 energy,
+                                 rotationEnergy};
+  std::copy(values, values + featureCount, features);
+}
+
+inline bool readFeatures(const std::string& file, std::vector<StrokeFeatures>& features) {
+  std::ifstream input(file, std::ios::binary);
+  FeatureHeader header, expected;
+  if(!input.read((char*) &header, sizeof(header)) || std::memcmp(header.magic, expected.magic, 4) != 0 ||
+     header.featureCount != featureCount) {
+    return false;
+  }
+  StrokeFeatures record;
+  while(input.read((char*) &record, sizeof(record))) {
+    features.push_back(record);
+  }
+  return input.gcount() == 0;
+}
+
+// strokes of several feature tables, false if one can't be read
+inline bool readArchive(const std::vector<std::string>& files, std::vector<ArchiveStroke>& strokes) {
+  for(uint32_t file = 0; file < files.size(); ++file) {
+    std::vector<StrokeFeatures> features;
+    if(!readFeatures(files[file], features)) {
+      return false;
+    }
+    for(const auto& stroke : features) {
+      strokes.push_back({file, stroke});
+    }
+  }
+  return true;
+}
+
+// segments strokes on the rotation velocity magnitude like StrokeSegmentationStage and hands their
+// features to done(); completed strokes are collected and their features computed in parallel once
+// batchSize of them are waiting
+class StrokeFeatureExtractor : public Stage {
+  static constexpr size_t batchSize = 64;
+  StrokeDetector detector;
+  LinearAccelerationColumns linearAcceleration;
+  double sampleRate;
+  int strokes = 0;
+
+  StrokeSamples current;
+  Vec3 lastRotation = {0, 0, 0}, lastLinear = {0, 0, 0}, lastAngle = {0, 0, 0};
+  std::vector<StrokeSamples> completed;
+  std::vector<StrokeFeatures> records;
+
+  void flush() {
+    records.resize(completed.size());
+    threadPool().parallelFor(completed.size(), [&](size_t s) {
+      const Stroke& stroke = completed[s].stroke;
+      records[s] = {strokes + (int32_t) s, stroke.start, stroke.end, {}};
+      strokeFeatures(completed[s], sampleRate, records[s].v);
+    });
+    done(records);
+    strokes += completed.size();
+    completed.clear();
+  }
+
+protected:
+  virtual void done(const std::vector<StrokeFeatures>& features) = 0;
+
+public:
+  StrokeFeatureExtractor(double sampleRate_, double startThreshold, double endThreshold)
+      : detector(startThreshold, endThreshold, 3), sampleRate(sampleRate_) {
+  }
+
+  void process(SampleBlock& block) override {
+    const int* linear = linearAcceleration(block);
+
+    for(size_t i = 0; i < block.size(); ++i) {
+      bool validRotation = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      Vec3 rotation = {block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]};
+      lastRotation = validRotation ? rotation : lastRotation;
+      if(isSet(block.valid[linear[0]], i)) {
+        lastLinear = {block.columns[linear[0]][i], block.columns[linear[1]][i], block.columns[linear[2]][i]};
+      }
+      if(isSet(block.valid[xAngle], i) && isSet(block.valid[yAngle], i) && isSet(block.valid[zAngle], i)) {
+        lastAngle = {block.columns[xAngle][i], block.columns[yAngle][i], block.columns[zAngle][i]};
+      }
+
+      bool ended = detector.push(block.t[i], std::sqrt(squaredNorm(rotation)), validRotation, current.stroke);
+      if(detector.isInStroke() || ended) {
+        current.rotation.push_back(lastRotation);
+        current.linearAcceleration.push_back(lastLinear);
+        current.angle.push_back(lastAngle);
+      }
+      if(ended) {
+        completed.push_back(current);
+      }
+      if(!detector.isInStroke()) {
+        current.rotation.clear();
+        current.linearAcceleration.clear();
+        current.angle.clear();
+      }
+    }
+    if(completed.size() >= batchSize) {
+      flush();
+    }
+  }
+
+  void finish() override {
+    if(detector.finish(current.stroke)) {
+      completed.push_back(current);
+    }
+    flush();
+  }
+};
+
+// writes the features of every stroke to a binary table
+class StrokeFeatureStage : public StrokeFeatureExtractor {
+  std::ofstream table;
+
+  void done(const std::vector<StrokeFeatures>& features) override {
+    table.write((const char*) features.data(), features.size() * sizeof(StrokeFeatures));
+  }
+
+public:
+  StrokeFeatureStage(const std::string& tableFile, double sampleRate, double startThreshold, double endThreshold)
+      : StrokeFeatureExtractor(sampleRate, startThreshold, endThreshold), table(tableFile, std::ios::binary) {
+    FeatureHeader header;
+    table.write((const char*) &header, sizeof(header));
+  }
+
+  void finish() override {
+    StrokeFeatureExtractor::finish();
+    table.flush();
+  }
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// filters as composable expressions, e.g.
+//   auto smooth = lowpass(20) | threshold(0.1) | magnitude();
+//   transform(smooth, xColumn, yColumn, zColumn, result);
+// an expression only holds parameters, bind<T>() turns it into a stateful kernel for samples of
+// type T (double or Vec3), the kernels of a composition are inlined into one loop over the columns
+
+constexpr double defaultSampleRate = 100;
+
+struct Vec3 {
+  double x, y, z;
+};
+
+inline Vec3 operator+(const Vec3& a, const Vec3& b) {
+  return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+inline Vec3 operator-(const Vec3& a, const Vec3& b) {
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+inline Vec3 operator*(double s, const Vec3& a) {
+  return {s * a.x, s * a.y, s * a.z};
+}
+
+inline double squaredNorm(double x) {
+  return x * x;
+}
+
+inline double squaredNorm(const Vec3& a) {
+  return a.x * a.x + a.y * a.y + a.z * a.z;
+}
+
+inline bool isValid(double x) {
+  return !std::isnan(x);
+}
+
+inline bool isValid(const Vec3& a) {
+  return !std::isnan(a.x) && !std::isnan(a.y) && !std::isnan(a.z);
+}
+
+template <class T>
+T invalid();
+
+template <>
+inline double invalid<double>() {
+  return std::numeric_limits<double>::quiet_NaN();
+}
+
+template <>
+inline Vec3 invalid<Vec3>() {
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  return {nan, nan, nan};
+}
+
+// tag of all expressions, enables operator|
+template <class Derived>
+struct Expression {
+  const Derived& self() const {
+    return static_cast<const Derived&>(*this);
+  }
+};
+
+// output type of a kernel for input type T
+template <class Kernel, class T>
+using resultOf = std::decay_t<decltype(std::declval<Kernel&>()(std::declval<const T&>()))>;
+
+template <class First, class Second>
+class PipeKernel {
+  First first;
+  Second second;
+
+public:
+  PipeKernel(First first_, Second second_) : first(first_), second(second_) {
+  }
+
+  template <class T>
+  auto operator()(const T& x) {
+    return second(first(x));
+  }
+};
+
+template <class A, class B>
+struct Pipe : Expression<Pipe<A, B>> {
+  A a;
+  B b;
+
+  Pipe(const A& a_, const B& b_) : a(a_), b(b_) {
+  }
+
+  template <class T>
+  auto bind() const {
+    auto first = a.template bind<T>();
+    auto second = b.template bind<resultOf<decltype(first), T>>();
+    return PipeKernel<decltype(first), decltype(second)>(first, second);
+  }
+};
+
+template <class A, class B>
+Pipe<A, B> operator|(const Expression<A>& a, const Expression<B>& b) {
+  return Pipe<A, B>(a.self(), b.self());
+}
+
+// drops scalars with a magnitude below the minimum (filterSmallValues) and vectors with a squared
+// norm below the minimum (filterSmallValuesAbs)
+template <class T>
+class ThresholdKernel;
+
+template <>
+class ThresholdKernel<double> {
+  double minValue;
+
+public:
+  ThresholdKernel(double minValue_) : minValue(minValue_) {
+  }
+
+  double operator()(double x) const {
+    return std::fabs(x) < minValue ? invalid<double>() : x;
+  }
+};
+
+template <>
+class ThresholdKernel<Vec3> {
+  double minValue;
+
+public:
+  ThresholdKernel(double minValue_) : minValue(minValue_) {
+  }
+
+  Vec3 operator()(const Vec3& a) const {
+    return squaredNorm(a) < minValue ? invalid<Vec3>() : a;
+  }
+};
+
+struct Threshold : Expression<Threshold> {
+  double minValue;
+
+  Threshold(double minValue_) : minValue(minValue_) {
+  }
+
+  template <class T>
+  ThresholdKernel<T> bind() const {
+    return {minValue};
+  }
+};
+
+inline Threshold threshold(double minValue) {
+  return {minValue};
+}
+
+// second order butterworth low pass
+template <class T>
+class LowPassKernel {
+  double b0, b1, b2, a1, a2;
+  T z1, z2;
+  bool started = false;
+
+public:
+  LowPassKernel(double cutoff, double sampleRate) {
+    double w0 = 2 * M_PI * cutoff / sampleRate;
+    double alpha = std::sin(w0) / std::sqrt(2.);
+    double a0 = 1 + alpha;
+    b0 = (1 - std::cos(w0)) / 2 / a0;
+    b1 = (1 - std::cos(w0)) / a0;
+    b2 = b0;
+    a1 = -2 * std::cos(w0) / a0;
+    a2 = (1 - alpha) / a0;
+  }
+
+  T operator()(const T& x) {
+    // invalid samples are passed through and leave the state untouched
+    if(!isValid(x)) {
+      return x;
+    }
+    // start in steady state to avoid the step response from zero
+    if(!started) {
+      z2 = (b2 - a2) * x;
+      z1 = (b1 - a1) * x + z2;
+      started = true;
+    }
+    T y = b0 * x + z1;
+    z1 = b1 * x - a1 * y + z2;
+    z2 = b2 * x - a2 * y;
+    return y;
+  }
+};
+
+struct LowPass : Expression<LowPass> {
+  double cutoff, sampleRate;
+
+  LowPass(double cutoff_, double sampleRate_) : cutoff(cutoff_), sampleRate(sampleRate_) {
+  }
+
+  template <class T>
+  LowPassKernel<T> bind() const {
+    return {cutoff, sampleRate};
+  }
+};
+
+inline LowPass lowpass(double cutoff, double sampleRate = defaultSampleRate) {
+  return {cutoff, sampleRate};
+}
+
+// peak envelope: maximum magnitude over the last window samples
+class EnvelopeKernel {
+  size_t window;
+  long n = 0;
+  std::deque<std::pair<long, double>> peaks;  // decreasing magnitudes
+
+public:
+  EnvelopeKernel(size_t window_) : window(window_) {
+  }
+
+  template <class T>
+  double operator()(const T& x) {
+    long i = n++;
+    if(isValid(x)) {
+      double magnitude = std::sqrt(squaredNorm(x));
+      while(!peaks.empty() && peaks.back().second <= magnitude) {
+        peaks.pop_back();
+      }
+      peaks.emplace_back(i, magnitude);
+    }
+    while(!peaks.empty() && peaks.front().first + (long) window <= i) {
+      peaks.pop_front();
+    }
+    return peaks.empty() ? invalid<double>() : peaks.front().second;
+  }
+};
+
+struct Envelope : Expression<Envelope> {
+  size_t window;
+
+  Envelope(size_t window_) : window(window_) {
+  }
+
+  template <class T>
+  EnvelopeKernel bind() const {
+    return {window};
+  }
+};
+
+inline Envelope envelope(size_t window) {
+  return {window};
+}
+
+struct MagnitudeKernel {
+  template <class T>
+  double operator()(const T& x) const {
+    return std::sqrt(squaredNorm(x));
+  }
+};
+
+struct Magnitude : Expression<Magnitude> {
+  template <class T>
+  MagnitudeKernel bind() const {
+    return {};
+  }
+};
+
+inline Magnitude magnitude() {
+  return {};
+}
+
+// evaluate an expression over a column, result written to out (may alias the input)
+template <class E, class Out>
+void transform(const Expression<E>& expression, const std::vector<double>& column, std::vector<Out>& out) {
+  auto kernel = expression.self().template bind<double>();
+  out.resize(column.size());
+  for(size_t i = 0; i < column.size(); ++i) {
+    out[i] = kernel(column[i]);
+  }
+}
+
+// evaluate an expression over the vectors formed by three columns
+template <class E, class Out>
+void transform(const Expression<E>& expression,
+               const std::vector<double>& x,
+               const std::vector<double>& y,
+               const std::vector<double>& z,
+               std::vector<Out>& out) {
+  auto kernel = expression.self().template bind<Vec3>();
+  out.resize(x.size());
+  for(size_t i = 0; i < x.size(); ++i) {
+    out[i] = kernel(Vec3{x[i], y[i], z[i]});
+  }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "filters.hpp"
+
+struct Impact {
+  double t;  // sub sample position
+  double amplitude;  // g
+};
+
+// vertex of the parabola through three equally spaced samples around a peak, offset in (-0.5, 0.5)
+// samples from the middle one
+inline Impact refinePeak(double before, double peak, double after) {
+  double curvature = before - 2 * peak + after;
+  double offset = curvature < 0 ? 0.5 * (before - after) / curvature : 0;
+  return {offset, peak - 0.25 * (before - after) * offset};
+}
+
+// local maxima of the acceleration magnitude above threshold (g), found on a sign change of the first
+// difference and refined to sub sample time and amplitude; of impacts closer than minDistance samples
+// only the highest is kept; a peak on the last sample of a block is decided with the next block
+class ImpactStage : public Stage {
+  double threshold;
+  int minDistance;
+  std::ofstream table;
+  int impacts = 0;
+  bool pending = false;  // impact waiting for higher ones within minDistance
+  Impact candidate;
+  // magnitudes and t of the block preceded by the last two samples of the previous one
+  std::vector<double> magnitude = std::vector<double>(2, invalid<double>());
+  std::vector<int> t = std::vector<int>(2, 0);
+  std::vector<uint64_t> peaks;
+
+  void write(const Impact& impact) {
+    table << impacts++ << "\t" << impact.t << "\t" << impact.amplitude << "\n";
+  }
+
+  void push(const Impact& impact) {
+    if(pending && impact.t - candidate.t >= minDistance) {
+      write(candidate);
+      pending = false;
+    }
+    if(!pending || impact.amplitude > candidate.amplitude) {
+      candidate = impact;
+      pending = true;
+    }
+  }
+
+public:
+  ImpactStage(const std::string& tableFile, double threshold_, int minDistance_)
+      : threshold(threshold_), minDistance(minDistance_), table(tableFile) {
+    table << "#impact,t,acceleration" << std::endl;
+  }
+
+  void process(SampleBlock& block) override {
+    size_t n = block.size();
+    magnitude.resize(n + 2);
+    t.resize(n + 2);
+    for(size_t i = 0; i < n; ++i) {
+      bool valid = isSet(block.valid[xAcc], i) && isSet(block.valid[yAcc], i) && isSet(block.valid[zAcc], i);
+      double m = std::sqrt(squaredNorm(Vec3{block.columns[xAcc][i], block.columns[yAcc][i], block.columns[zAcc][i]}));
+      magnitude[i + 2] = valid ? m : invalid<double>();
+      t[i + 2] = block.t[i];
+    }
+
+    // candidates j = 1 ... n, rising into j and not rising after it; comparisons with invalid (NaN)
+    // neighbours are false
+    peaks.assign((n + 64) / 64, 0);
+    for(size_t w = 0; w < peaks.size(); ++w) {
+      uint64_t bits = 0;
+      size_t from = 64 * w + 1, to = std::min(from + 64, n + 1);
+      for(size_t j = from; j < to; ++j) {
+        // & instead of && keeps the loop free of control flow
+        bool peak = (magnitude[j] - magnitude[j - 1] > 0) & (magnitude[j + 1] - magnitude[j] <= 0) &
+                    (magnitude[j] > threshold);
+        bits |= uint64_t(peak) << (j - from);
+      }
+      peaks[w] = bits;
+    }
+    for(size_t w = 0; w < peaks.size(); ++w) {
+      for(uint64_t bits = peaks[w]; bits; bits &= bits - 1) {
+        size_t j = 64 * w + 1 + __builtin_ctzll(bits);
+        Impact impact = refinePeak(magnitude[j - 1], magnitude[j], magnitude[j + 1]);
+        // offset is in samples, scale it by the spacing of the neighbours
+        impact.t = t[j] + impact.t * (impact.t < 0 ? t[j] - t[j - 1] : t[j + 1] - t[j]);
+        push(impact);
+      }
+    }
+
+    magnitude[0] = magnitude[n];
+    magnitude[1] = magnitude[n + 1];
+    t[0] = t[n];
+    t[1] = t[n + 1];
+  }
+
+  void finish() override {
+    if(pending) {
+      write(candidate);
+      pending = false;
+    }
+    table.flush();
+  }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "neighbors.hpp"
+#include "parallel.hpp"
+
+// k means over row major points with k means++ seeding and hamerly's bounds: every point keeps an upper
+// bound on the distance to its center and a lower bound on the distance to all others, and only
+// computes distances to all centers once the bounds no longer prove its assignment; the assignment
+// runs in parallel over chunks of points
+class KMeans {
+  const float* points;
+  size_t n;
+  int dimensions, k;
+  std::vector<float> centers;
+  std::vector<uint32_t> assignment;
+  std::vector<float> upper, lower;
+  std::mt19937 random;
+
+  static constexpr size_t chunkSize = 1024;
+
+  const float* point(size_t i) const {
+    return points + i * dimensions;
+  }
+
+  const float* center(size_t j) const {
+    return centers.data() + j * dimensions;
+  }
+
+  float distance(const float* a, const float* b) const {
+    return std::sqrt(squaredDistance(a, b, dimensions));
+  }
+
+  size_t chunks() const {
+    return (n + chunkSize - 1) / chunkSize;
+  }
+
+  // d^2 sampling: each further center is drawn with probability proportional to the squared distance to
+  // the nearest one chosen so far
+  void seed() {
+    std::vector<float> nearest(n, std::numeric_limits<float>::infinity());
+    size_t chosen = std::uniform_int_distribution<size_t>(0, n - 1)(random);
+    for(int j = 0; j < k; ++j) {
+      std::copy(point(chosen), point(chosen) + dimensions, centers.begin() + j * dimensions);
+      threadPool().parallelFor(chunks(), [&](size_t c) {
+        for(size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); ++i) {
+          nearest[i] = std::min(nearest[i], squaredDistance(point(i), center(j), dimensions));
+        }
+      });
+      double total = 0;
+      for(float d : nearest) {
+        total += d;
+      }
+      double target = std::uniform_real_distribution<double>(0, total)(random);
+      for(chosen = 0; chosen + 1 < n && (target -= nearest[chosen]) > 0; ++chosen) {
+      }
+    }
+  }
+
+  // nearest and second nearest center of a point
+  void nearestCenters(size_t i, uint32_t& best, float& bestDistance, float& secondDistance) const {
+    bestDistance = secondDistance = std::numeric_limits<float>::infinity();
+    for(int j = 0; j < k; ++j) {
+      float d = distance(point(i), center(j));
+      if(d < bestDistance) {
+        secondDistance = bestDistance;
+        bestDistance = d;
+        best = j;
+      } else if(d < secondDistance) {
+        secondDistance = d;
+      }
+    }
+  }
+
+public:
+  KMeans(const float* points_, size_t n_, int dimensions_, int k_, unsigned seed = 42)
+      : points(points_),
+        n(n_),
+        dimensions(dimensions_),
+        k(std::min(k_, (int) n_)),
+        centers(k * dimensions),
+        assignment(n),
+        upper(n),
+        lower(n),
+        random(seed) {
+  }
+
+  // returns the iterations until no assignment changed, at most maxIterations
+  int run(int maxIterations = 100) {
+    if(n == 0) {
+      return 0;
+    }
+    seed();
+    threadPool().parallelFor(chunks(), [&](size_t c) {
+      for(size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); ++i) {
+        nearestCenters(i, assignment[i], upper[i], lower[i]);
+      }
+    });
+
+    std::vector<float> halfGap(k), moved(k);
+    std::vector<double> sums(k * dimensions);
+    std::vector<size_t> counts(k);
+    std::vector<size_t> changes(chunks());
+    int iteration = 0;
+    while(iteration++ < maxIterations) {
+      // centers
+      std::fill(sums.begin(), sums.end(), 0);
+      std::fill(counts.begin(), counts.end(), 0);
+      for(size_t i = 0; i < n; ++i) {
+        ++counts[assignment[i]];
+        for(int d = 0; d < dimensions; ++d) {
+          sums[assignment[i] * dimensions + d] += point(i)[d];
+        }
+      }
+      float maxMoved = 0, secondMoved = 0;
+      int farthest = 0;
+      for(int j = 0; j < k; ++j) {
+        std::vector<float> updated(center(j), center(j) + dimensions);
+        if(counts[j] > 0) {
+          for(int d = 0; d < dimensions; ++d) {
+            updated[d] = sums[j * dimensions + d] / counts[j];
+          }
+        }
+        moved[j] = distance(center(j), updated.data());
+        std::copy(updated.begin(), updated.end(), centers.begin() + j * dimensions);
+        if(moved[j] > maxMoved) {
+          secondMoved = maxMoved;
+          maxMoved = moved[j];
+          farthest = j;
+        } else if(moved[j] > secondMoved) {
+          secondMoved = moved[j];
+        }
+      }
+      // half the distance to the nearest other center, a point closer than that to its own center
+      // can't be nearer to another one
+      for(int j = 0; j < k; ++j) {
+        halfGap[j] = std::numeric_limits<float>::infinity();
+        for(int other = 0; other < k; ++other) {
+          if(other != j) {
+            halfGap[j] = std::min(halfGap[j], distance(center(j), center(other)) / 2);
+          }
+        }
+      }
+
+      threadPool().parallelFor(chunks(), [&](size_t c) {
+        changes[c] = 0;
+        for(size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); ++i) {
+          uint32_t a = assignment[i];
+          upper[i] += moved[a];
+          lower[i] -= a == (uint32_t) farthest ? secondMoved : maxMoved;
+          float bound = std::max(halfGap[a], lower[i]);
+          if(upper[i] <= bound) {
+            continue;
+          }
+          upper[i] = distance(point(i), center(a));
+          if(upper[i] <= bound) {
+            continue;
+          }
+          nearestCenters(i, assignment[i], upper[i], lower[i]);
+          changes[c] += assignment[i] != a;
+        }
+      });
+      size_t changed = 0;
+      for(size_t c : changes) {
+        changed += c;
+      }
+      if(changed == 0) {
+        break;
+      }
+    }
+    return std::min(iteration, maxIterations);
+  }
+
+  int clusters() const {
+    return k;
+  }
+
+  const float* centerOf(int j) const {
+    return center(j);
+  }
+
+  uint32_t clusterOf(size_t i) const {
+    return assignment[i];
+  }
+
+  float distanceToCenter(size_t i) const {
+    return distance(point(i), center(assignment[i]));
+  }
+};
@@ -2,12 +2,19 @@
 #include <numeric>
 #include <vector>
 #include <limits>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <string>
+
+#include "calibration.hpp"
+#include "kmeans.hpp"
+#include "pipeline.hpp"
 
 using namespace std;
 constexpr bool checkConsistency = true;
 constexpr int blockSize = 11;
-constexpr double nan = numeric_limits<double>::quiet_NaN();
+constexpr double NaN = numeric_limits<double>::quiet_NaN();
 
 
 enum attributeType {
@@ -17,24 +24,77 @@ enum attributeType {
 };
 
 
-// values stored in two bytes, low and hight part
+// values stored in two bytes, low and hight part; the low byte is unsigned, as a char it would sign
+// extend into the high one
 auto bytesToVal(char low, char high) {
-  short val = low | (high << 8);
+  short val = (unsigned char) low | (high << 8);
   return val;
 }
 
+// squared norm threshold of filterSmallValuesAbs(minValue) in raw units, for the test in decode before
+// the float conversion
+uint32_t rawIdleThreshold(double minValue, attributeType type) {
+  double rawMinSquared = minValue * (32760.0 / type) * (32760.0 / type);
+  return ceil(min(rawMinSquared, (double) numeric_limits<uint32_t>::max()));
+}
+
+// conversion of the raw values of one attribute kind, built once per file and passed to the decode of
+// every frame
+class AttributeDecoding {
+public:
+  double type;
+  double minValue;  // frames with a squared norm below are dropped
+  uint32_t rawMinValue;  // minValue in raw units, tested before the float conversion if not calibrated
+  bool calibrated = false;  // raw norms no longer map to calibrated ones, the test runs after calibrating
+  double scale[3] = {1, 1, 1}, offset[3] = {0, 0, 0};  // calibration folded into the conversion
+  bool withTemperature = false;  // temp is only decoded if set
+  double referenceTemperature = 0, linearDrift[3] = {0, 0, 0}, quadraticDrift[3] = {0, 0, 0};  // scaled
+  bool mounted = false;
+  double mounting[9];  // sensor to racket rotation, row major
+
+  AttributeDecoding(attributeType theType, double minValue_)
+      : type(theType), minValue(minValue_), rawMinValue(rawIdleThreshold(minValue_, theType)) {
+  }
+
+  // decode then yields (nominal - bias) * scale per axis
+  void setCalibration(const double* bias, const double* scale_) {
+    for(int a = 0; a < 3; ++a) {
+      scale[a] = scale_[a];
+      offset[a] = -bias[a] * scale_[a];
+      calibrated |= scale[a] != 1 || offset[a] != 0;
+    }
+  }
+
+  // decode then subtracts (linear + quadratic * dT) * dT with dT = temp - reference from the nominal values
+  void setTemperatureDrift(double reference, const double* linear, const double* quadratic) {
+    withTemperature = true;
+    calibrated = true;
+    referenceTemperature = reference;
+    for(int a = 0; a < 3; ++a) {
+      linearDrift[a] = linear[a] * scale[a];
+      quadraticDrift[a] = quadratic[a] * scale[a];
+    }
+  }
+
+  // decode then rotates x, y, z into the racket frame
+  void setMounting(const double* mounting_) {
+    mounted = true;
+    copy(mounting_, mounting_ + 9, mounting);
+  }
+};
+
 class PhysicalAttribute {
 public:
-  double x, y, z, temp, type;
+  double x, y, z, temp;
   bool consistent;  // check sum correct?
+  unsigned char valid = 0b111;  // x, y, z not filtered out, bit 0 is x
 
-  PhysicalAttribute( attributeType theType ) {
-    type = theType;
+  PhysicalAttribute() {
     setToNan();
   }
 
   void setToNan() {
-    x = y = z = temp = nan;
+    x = y = z = temp = NaN;
     consistent = false;
   }
 
@@ -42,29 +102,67 @@ public:
     (accumulate(data, data + 10, (char) 0) == data[10]) ? consistent = true : consistent = false;
   }
 
-  void decode(char data[]) {
-    x = bytesToVal(data[2], data[3]) / 32760.0 * type;
-    y = bytesToVal(data[4], data[5]) / 32760.0 * type;
-    z = bytesToVal(data[6], data[7]) / 32760.0 * type;
-    temp = bytesToVal(data[8], data[9]) / 340. + 36.53;
+  void decode(char data[], const AttributeDecoding& decoding) {
     checkConsistency(data);
+    int32_t rawX = bytesToVal(data[2], data[3]);
+    int32_t rawY = bytesToVal(data[4], data[5]);
+    int32_t rawZ = bytesToVal(data[6], data[7]);
+    // each square fits in 30 bits, the sum in 32 unsigned ones
+    if(!decoding.calibrated &&
+       uint32_t(rawX * rawX) + uint32_t(rawY * rawY) + uint32_t(rawZ * rawZ) < decoding.rawMinValue) {
+      valid = 0;
+      return;
+    }
+    x = rawX / 32760.0 * decoding.type * decoding.scale[0] + decoding.offset[0];
+    y = rawY / 32760.0 * decoding.type * decoding.scale[1] + decoding.offset[1];
+    z = rawZ / 32760.0 * decoding.type * decoding.scale[2] + decoding.offset[2];
+    if(decoding.withTemperature) {
+      temp = bytesToVal(data[8], data[9]) / 340. + 36.53;
+      double dT = temp - decoding.referenceTemperature;
+      x -= (decoding.linearDrift[0] + decoding.quadraticDrift[0] * dT) * dT;
+      y -= (decoding.linearDrift[1] + decoding.quadraticDrift[1] * dT) * dT;
+      z -= (decoding.linearDrift[2] + decoding.quadraticDrift[2] * dT) * dT;
+    }
+    // the mounting rotation keeps the norm, so this is the same test on the values written out
+    if(decoding.calibrated && x * x + y * y + z * z < decoding.minValue) {
+      valid = 0;
+      return;
+    }
+    if(decoding.mounted && decoding.type == angleType) {
+      // euler angles have no per axis linear transform, R_racket = R_sensor mounting^T
+      double sensor[9], racket[9];
+      eulerToMatrix(x, y, z, sensor);
+      for(int a = 0; a < 3; ++a) {
+        for(int b = 0; b < 3; ++b) {
+          const double* row = sensor + 3 * a;
+          const double* mountingRow = decoding.mounting + 3 * b;
+          racket[3 * a + b] = row[0] * mountingRow[0] + row[1] * mountingRow[1] + row[2] * mountingRow[2];
+        }
+      }
+      matrixToEuler(racket, x, y, z);
+    } else if(decoding.mounted) {
+      double sensorX = x, sensorY = y, sensorZ = z;
+      x = decoding.mounting[0] * sensorX + decoding.mounting[1] * sensorY + decoding.mounting[2] * sensorZ;
+      y = decoding.mounting[3] * sensorX + decoding.mounting[4] * sensorY + decoding.mounting[5] * sensorZ;
+      z = decoding.mounting[6] * sensorX + decoding.mounting[7] * sensorY + decoding.mounting[8] * sensorZ;
+    }
   }
 
   void filterSmallValues(double minValue) {
-
-    for( auto& i : {&x, &y, &z}){
-        if (*i< minValue){
-            *i = nan;
-        }
-    }
+    valid &= (fabs(x) >= minValue) | (fabs(y) >= minValue) << 1 | (fabs(z) >= minValue) << 2;
   }
 
   void filterSmallValuesAbs(double minValue){
     if(x*x+y*y+z*z < minValue){
-      x=y=z=nan;
+      valid = 0;
     }
   }
 
+  // valid bits of x, y, z combined with the check sum
+  unsigned char validMask() const {
+    return (!::checkConsistency || consistent) ? valid : 0;
+  }
+
   virtual ~PhysicalAttribute() = default;
 };
 
@@ -98,7 +196,8 @@ public:
  }
 };
 
-void analyzePhysicalAttribute(PhysicalAttribute* physicalAttribute, char* data, int& blockIdx, ifstream& input) {
+void analyzePhysicalAttribute(PhysicalAttribute* physicalAttribute, const AttributeDecoding& decoding, char* data,
+                              int& blockIdx, ifstream& input) {
   char val;
   while(blockIdx < blockSize) {
     if(input >> val) {  // handle file end
@@ -107,41 +206,62 @@ void analyzePhysicalAttribute(PhysicalAttribute* physicalAttribute, char* data,
       return;
     }
   }
-  physicalAttribute->decode(data);
+  physicalAttribute->decode(data, decoding);
   blockIdx = 0;
 }
 
-vector<DataPoint*> readFile(ifstream& input) {
+// attributes with a squared norm below their minimum are dropped, without being decoded unless there is
+// a calibration, the others are calibrated while decoding
+vector<DataPoint*> readFile(ifstream& input,
+                            double minValueAcceleration = 0,
+                            double minValueAngle = 0,
+                            double minValueRotationVelocity = 0,
+                            const Calibration& calibration = Calibration()) {
   // read data Blocks
   vector<DataPoint*> dataPoints = {};
   int blockIdx = 0;
   int timestep = 0;
   char data[blockSize] = {0};
   char val;
+  AttributeDecoding accelerationDecoding(accelerationType, minValueAcceleration);
+  AttributeDecoding angleDecoding(angleType, minValueAngle);
+  AttributeDecoding rotationVelocityDecoding(rotationVelocityType, minValueRotationVelocity);
+  accelerationDecoding.setCalibration(calibration.bias[0], calibration.scale[0]);
+  angleDecoding.setCalibration(calibration.bias[1], calibration.scale[1]);
+  rotationVelocityDecoding.setCalibration(calibration.bias[2], calibration.scale[2]);
+  if(calibration.temperatureCompensation) {
+    rotationVelocityDecoding.setTemperatureDrift(calibration.referenceTemperature, calibration.drift[0],
+                                                 calibration.drift[1]);
+  }
+  if(calibration.mounted) {
+    accelerationDecoding.setMounting(calibration.mounting);
+    angleDecoding.setMounting(calibration.mounting);
+    rotationVelocityDecoding.setMounting(calibration.mounting);
+  }
   while(input >> val) {
     // hit header
     if((val ^ 0x55) == 0) {
-      auto* angle = new PhysicalAttribute(angleType);
-      auto* rotationVelocity = new PhysicalAttribute(rotationVelocityType);
-      auto* acceleration = new PhysicalAttribute(accelerationType);
+      auto* angle = new PhysicalAttribute();
+      auto* rotationVelocity = new PhysicalAttribute();
+      auto* acceleration = new PhysicalAttribute();
       blockIdx = 0;
       data[blockIdx++] = val;
       // the demanded order  is 0x51, 0x52, 0x52
       // read 0x51
       if(((input >> val) && val ^ 0x51) == 0) {
         data[blockIdx++] = 0x51;
-        analyzePhysicalAttribute(acceleration, data, blockIdx, input);
+        analyzePhysicalAttribute(acceleration, accelerationDecoding, data, blockIdx, input);
       }
       // read 0x52
       if(input >> val && (val ^ 0x55) == 0 && (input >> val) && (val ^ 0x52) == 0) {
         data[blockIdx++] = 0x55;
         data[blockIdx++] = val;
-        analyzePhysicalAttribute(rotationVelocity, data, blockIdx, input);
+        analyzePhysicalAttribute(rotationVelocity, rotationVelocityDecoding, data, blockIdx, input);
       }  // read 0x53
       if(input >> val && (val ^ 0x55) == 0 && (input >> val) && (val ^ 0x53) == 0) {
         data[blockIdx++] = 0x55;
         data[blockIdx++] = val;
-        analyzePhysicalAttribute(angle, data, blockIdx, input);
+        analyzePhysicalAttribute(angle, angleDecoding, data, blockIdx, input);
       }
       // only if a single valid point was hit (may create missing time steps)
       if(acceleration->consistent || rotationVelocity->consistent || angle->consistent) {
@@ -156,40 +276,155 @@ vector<DataPoint*> readFile(ifstream& input) {
   return dataPoints;
 }
 
-void writeNanPoint(ofstream& output) {
-  output << nan << "\t" << nan << "\t" << nan << "\t";
+// copy data points [begin, begin + blockLength) into the columns of block, with temperature also the
+// temperature of the rotation velocity frames into a temperature column
+void loadBlock(const vector<DataPoint*>& data, size_t begin, SampleBlock& block, bool temperature = false) {
+  size_t n = min(data.size() - begin, (size_t) blockLength);
+  block.resize(n);
+  for(size_t i = 0; i < n; ++i) {
+    DataPoint* date = data[begin + i];
+    block.t[i] = date->t;
+    int c = 0;
+    for(PhysicalAttribute* physicalAttribute : {date->acceleration, date->angle, date->rotationVelocity}) {
+      // print only data with valid consistency check
+      unsigned char valid = physicalAttribute->validMask();
+      for(double value : {physicalAttribute->x, physicalAttribute->y, physicalAttribute->z}) {
+        block.columns[c][i] = value;
+        setBit(block.valid[c++], i, valid & 1);
+        valid >>= 1;
+      }
+    }
+    if(temperature) {
+      int column = block.column("temperature");
+      block.columns[column][i] = date->rotationVelocity->temp;
+      setBit(block.valid[column], i, date->rotationVelocity->validMask() && !std::isnan(date->rotationVelocity->temp));
+    }
+  }
 }
 
-void write(vector<DataPoint*> data, ofstream& output) {
-  output << "#t,xAcceleration,yAcceleration,zAcceleration,xAngle,yAngle,zAngle,"
-            "xAngulearVelocity,yAngularVelocity,zAngularVelocity"
-         << endl;
-  // print only data with valid consistency check
-  if(checkConsistency) {
-      for (DataPoint* date : data) {
-          output << date->t << "\t"; 
-          for (PhysicalAttribute* physicalAttribute : {date->acceleration, date->angle, date->rotationVelocity}) {
-              if (physicalAttribute->consistent) {
-                  for (double i : {physicalAttribute->x, physicalAttribute->y, physicalAttribute->z}) {
-                      output << i << "\t";
-                  }
-              } else {
-                  writeNanPoint(output);
-              }
-
-          }
-          output << endl;
+void writeHeader(const SampleBlock& block, ofstream& output) {
+  output << "#t";
+  for(const auto& name : block.names) {
+    output << "," << name;
+  }
+  output << endl;
+}
+
+// invalid values are written as nan, samples without any valid value are skipped
+void writeBlock(const SampleBlock& block, ofstream& output) {
+  for(size_t w = 0; w < block.words(); ++w) {
+    uint64_t anyValid = 0;
+    for(const auto& mask : block.valid) {
+      anyValid |= mask[w];
+    }
+    for(; anyValid; anyValid &= anyValid - 1) {
+      size_t i = 64 * w + __builtin_ctzll(anyValid);
+      output << block.t[i] << "\t";
+      for(size_t c = 0; c < block.columns.size(); ++c) {
+        if(isSet(block.valid[c], i)) {
+          output << block.columns[c][i] << "\t";
+        } else {
+          output << "nan\t";
+        }
       }
-  }else {
-    for(auto date : data) {
-      output << date->t << "\t" << date->acceleration->x << "\t" << date->acceleration->y << "\t"
-             << date->acceleration->z << "\t" << date->angle->x << "\t" << date->angle->y << "\t" << date->angle->z
-             << "\t" << date->rotationVelocity->x << "\t" << date->rotationVelocity->y << "\t"
-             << date->rotationVelocity->z << endl;
+      output << endl;
     }
   }
 }
 
+// run every stage of the pipeline on one block at a time and stream the result out
+void process(const vector<DataPoint*>& data, Pipeline& pipeline, ofstream& output) {
+  SampleBlock block;
+  for(size_t begin = 0; begin < data.size(); begin += blockLength) {
+    loadBlock(data, begin, block);
+    pipeline.process(block);
+    if(begin == 0) {
+      writeHeader(block, output);
+    }
+    writeBlock(block, output);
+  }
+  pipeline.finish();
+  if(data.empty()) {
+    writeHeader(block, output);
+  }
+}
+
+// groups the strokes of feature tables into k clusters over their normalized features, writes the cluster
+// of every stroke to output and the cluster centers to <output>.centroids.tsv
+bool cluster(const vector<string>& archiveFiles, int k, const string& outputFile) {
+  vector<ArchiveStroke> strokes;
+  if(!readArchive(archiveFiles, strokes)) {
+    return false;
+  }
+  FeatureNormalization normalization(strokes);
+  vector<float> points(strokes.size() * featureCount);
+  for(size_t i = 0; i < strokes.size(); ++i) {
+    normalization.apply(strokes[i].features.v, &points[i * featureCount]);
+  }
+  KMeans kMeans(points.data(), strokes.size(), featureCount, k);
+  int iterations = kMeans.run();
+  cout << "Converged after " << iterations << " iterations" << endl;
+
+  ofstream output(outputFile);
+  output << "#archive,stroke,start,end,cluster,distance" << endl;
+  for(size_t i = 0; i < strokes.size(); ++i) {
+    const StrokeFeatures& features = strokes[i].features;
+    output << archiveFiles[strokes[i].file] << "\t" << features.stroke << "\t" << features.start << "\t"
+           << features.end << "\t" << kMeans.clusterOf(i) << "\t" << kMeans.distanceToCenter(i) << "\n";
+  }
+
+  vector<size_t> sizes(kMeans.clusters());
+  for(size_t i = 0; i < strokes.size(); ++i) {
+    ++sizes[kMeans.clusterOf(i)];
+  }
+  ofstream centroids(outputFile + ".centroids.tsv");
+  centroids << "#cluster,strokes";
+  for(const char* name : featureNames) {
+    centroids << "," << name;
+  }
+  centroids << endl;
+  for(int j = 0; j < kMeans.clusters(); ++j) {
+    float center[featureCount];
+    normalization.invert(kMeans.centerOf(j), center);
+    centroids << j << "\t" << sizes[j];
+    for(float value : center) {
+      centroids << "\t" << value;
+    }
+    centroids << "\n";
+  }
+  return output.good() && centroids.good();
+}
+
+// estimates a calibration from the static periods of at least a second of a recording, data has to be
+// decoded with temperatures for the drift fit; on failure the reason is returned in error
+bool calibrate(const vector<DataPoint*>& data, double sampleRate, const string& calibrationFile, string& error) {
+  CalibrationStage estimator(0.001, 1, sampleRate);
+  SampleBlock block;
+  for(size_t begin = 0; begin < data.size(); begin += blockLength) {
+    loadBlock(data, begin, block, true);
+    estimator.process(block);
+  }
+  estimator.finish();
+  Calibration calibration;
+  if(!estimator.estimate(calibration, error)) {
+    return false;
+  }
+  error = "Can't write to calibration file";
+  return writeCalibration(calibrationFile, calibration);
+}
+
+// adds the mounting rotation estimated from a recording turning the racket around its handle to the
+// calibration file, data has to be decoded with the calibration already in it
+bool calibrateMounting(const vector<DataPoint*>& data, Calibration& calibration, const string& calibrationFile) {
+  MountingStage estimator(30);
+  SampleBlock block;
+  for(size_t begin = 0; begin < data.size(); begin += blockLength) {
+    loadBlock(data, begin, block);
+    estimator.process(block);
+  }
+  return estimator.estimate(calibration) && writeCalibration(calibrationFile, calibration);
+}
+
 void filterSmallValuesAbs(vector<DataPoint*> data,
                        double minValueAcceleration,
                        double minValueAngle,
@@ -209,37 +444,145 @@ void filterSmallValues(vector<DataPoint*> data,
   }
 }
 
-void filterLowPass(vector<DataPoint*> data) {
-}
-
-void filterEnveloping(vector<DataPoint*> data) {
-}
-
 int main(int argc, char** argv) {
-  if(argc != 3) {
-    cout << "usage: binary <input binary> <output file>" << endl;
+  vector<string> files;
+  string pipelineSpec;
+  vector<double> idle = {0, 0, 0};
+  vector<string> templateFiles;
+  vector<string> archiveFiles;
+  double sampleRate = defaultSampleRate;
+  int clusters = 0;
+  bool calibrating = false, mounting = false;
+  string calibrationFile;
+  for(int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if(arg == "--pipeline" && i + 1 < argc) {
+      pipelineSpec = argv[++i];
+    } else if(arg == "--idle" && i + 1 < argc) {
+      auto values = split(argv[++i], ',');
+      idle.assign(values.size(), 0);
+      for(size_t v = 0; v < values.size(); ++v) {
+        // a malformed threshold leaves idle with the wrong size, which prints the usage
+        if(!parseValue(values[v], idle[v])) {
+          idle.clear();
+          break;
+        }
+      }
+    } else if(arg == "--templates" && i + 1 < argc) {
+      templateFiles = split(argv[++i], ',');
+    } else if(arg == "--archive" && i + 1 < argc) {
+      archiveFiles = split(argv[++i], ',');
+    } else if(arg == "--cluster" && i + 1 < argc) {
+      clusters = atoi(argv[++i]);
+    } else if(arg == "--calibrate") {
+      calibrating = true;
+    } else if(arg == "--mounting") {
+      mounting = true;
+    } else if(arg == "--calibration" && i + 1 < argc) {
+      calibrationFile = argv[++i];
+    } else if(arg == "--rate" && i + 1 < argc) {
+      sampleRate = atof(argv[++i]);
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if(clusters > 0 && files.size() == 1 && !archiveFiles.empty()) {
+    if(!cluster(archiveFiles, clusters, files[0])) {
+      cout << "Bad feature table!" << endl;
+      return 0;
+    }
+    cout << "Clusters written to output file" << endl;
+    return 0;
+  }
+  if(files.size() != 2 || sampleRate <= 0 || idle.size() != 3) {
+    cout << "usage: binary <input binary> <output file> [--pipeline <spec>] [--rate <sample rate in Hz>] "
+            "[--idle <acc>,<angle>,<rot>] [--templates <file>[,<file>...]] [--archive <file>[,<file>...]] "
+            "[--calibration <file>]"
+         << endl;
+    cout << "       binary --calibrate <static input binary> <calibration file>" << endl;
+    cout << "       binary --mounting <turn input binary> <calibration file>" << endl;
+    cout << "       binary --cluster <k> --archive <file>[,<file>...] <output file>" << endl;
+    cout << "pipeline spec: stages separated by |, e.g. \"smallabs:0.1,0,0|lowpass:20Hz|envelope:50\"" << endl;
+    cout << "stages: small:<acc>,<angle>,<rot> smallabs:<acc>,<angle>,<rot> lowpass:<cutoff> envelope:<window> "
+            "stats:<window> resample:<rate> median:<window> hampel:<window>[,<k>] "
+            "savgol:<window>,<order>[,<derivative>] madgwick[:<beta>] mahony[:<kp>[,<ki>]] "
+            "linear trajectory[:<max rot>,<max acc variance>,<window>] "
+            "strokes:<start>,<end>[,<min length>[,<envelope window>]] templates:<start>,<end> "
+            "classify:<start>,<end>[,<band>] tempo:<window>[,<hop>] "
+            "falls[:<free fall>,<impact>[,<min free fall>,<max gap>]] impacts:<threshold>[,<min distance>] "
+            "features:<start>,<end> neighbors:<start>,<end>[,<k>] "
+            "motifs:<channel>,<length>[,<fraction>] unwrap[:<quaternion>] euler quaternion matrix"
+         << endl;
+    cout << "idle: attributes with a squared norm below <acc>,<angle>,<rot> are dropped while decoding" << endl;
+    return 0;
+  }
+
+  Calibration calibration;
+  if(!calibrating && !calibrationFile.empty() && !readCalibration(calibrationFile, calibration)) {
+    cout << "Bad calibration file!" << endl;
+    return 0;
+  }
+  // an existing calibration file is extended by the mounting, estimated in its calibrated sensor frame
+  if(mounting && ifstream(files[1]).good() && !readCalibration(files[1], calibration)) {
+    cout << "Bad calibration file!" << endl;
+    return 0;
+  }
+  calibration.mounted &= !mounting;
+
+  Pipeline pipeline(sampleRate);
+  pipeline.tablePrefix = files[1];
+  pipeline.templateFiles = templateFiles;
+  pipeline.archiveFiles = archiveFiles;
+  // file name without directory and extension
+  pipeline.recordingName = files[0].substr(files[0].find_last_of('/') + 1);
+  pipeline.recordingName = pipeline.recordingName.substr(0, pipeline.recordingName.find('.'));
+  string error;
+  if(!pipelineSpec.empty() && !pipeline.parse(pipelineSpec, error)) {
+    cout << "Bad pipeline stage: " << error << endl;
     return 0;
   }
 
-  ifstream input(argv[1], ios::binary);
+  ifstream input(files[0], ios::binary);
   if(!input.good()) {
     cout << "Bad input file!" << endl;
     return 0;
   }
+  // bytes are read with >>, which would skip the ones that look like white space
+  input >> noskipws;
+
+  if(calibrating) {
+    // a drift model with no drift, only to have temperatures decoded
+    calibration.temperatureCompensation = true;
+    vector<DataPoint*> data = readFile(input, 0, 0, 0, calibration);
+    string error;
+    if(!calibrate(data, sampleRate, files[1], error)) {
+      cout << error << endl;
+      return 0;
+    }
+    cout << "Calibration written to output file" << endl;
+    return 0;
+  }
 
-  ofstream output(argv[2]);
+  if(mounting) {
+    vector<DataPoint*> data = readFile(input, 0, 0, 0, calibration);
+    if(!calibrateMounting(data, calibration, files[1])) {
+      cout << "No clear rotation axis found!" << endl;
+      return 0;
+    }
+    cout << "Mounting written to calibration file" << endl;
+    return 0;
+  }
+
+  ofstream output(files[1]);
   if(!output.good()) {
     cout << "Can't write to ouput file" << endl;
     return 0;
   }
 
-  vector<DataPoint*> data = readFile(input);
+  vector<DataPoint*> data = readFile(input, idle[0], idle[1], idle[2], calibration);
   cout << "Data read" << endl;
 
-  // filters
-  //filterSmallValues(data, 0.1, 0, 0);
-
-  write(data, output);
+  process(data, pipeline, output);
   cout << "Results written to output file" << endl;
   return 0;
 }
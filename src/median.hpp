@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+
+#include "block.hpp"
+#include "parallel.hpp"
+
+// order statistics of the last window samples in O(log window) per sample, the samples are kept in
+// an indexable red black tree, the sample index makes equal values distinct
+class RollingOrderStatistics {
+  using Tree = __gnu_pbds::tree<std::pair<double, long>,
+                                __gnu_pbds::null_type,
+                                std::less<std::pair<double, long>>,
+                                __gnu_pbds::rb_tree_tag,
+                                __gnu_pbds::tree_order_statistics_node_update>;
+  size_t window;
+  long pushed = 0;
+  Tree tree;
+  std::vector<double> ring;
+  std::vector<bool> ringValid;
+
+public:
+  RollingOrderStatistics(size_t window_) : window(window_), ring(window_), ringValid(window_, false) {
+  }
+
+  // invalid samples take a slot in the window but aren't part of it
+  void push(double x, bool valid) {
+    size_t slot = pushed % window;
+    if(ringValid[slot]) {
+      tree.erase(std::make_pair(ring[slot], pushed - (long) window));
+    }
+    ring[slot] = x;
+    ringValid[slot] = valid;
+    if(valid) {
+      tree.insert(std::make_pair(x, pushed));
+    }
+    ++pushed;
+  }
+
+  size_t count() const {
+    return tree.size();
+  }
+
+  // value at quantile q in [0, 1], linear between neighbouring ranks
+  double quantile(double q) const {
+    if(tree.empty()) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    double rank = q * (tree.size() - 1);
+    size_t below = std::floor(rank);
+    double low = tree.find_by_order(below)->first;
+    if(below + 1 >= tree.size()) {
+      return low;
+    }
+    double high = tree.find_by_order(below + 1)->first;
+    return low + (rank - below) * (high - low);
+  }
+
+  double median() const {
+    return quantile(0.5);
+  }
+};
+
+// median of the window ending at each sample, lags the input by (window - 1) / 2 samples
+class MedianKernel {
+  RollingOrderStatistics statistics;
+
+public:
+  MedianKernel(size_t window) : statistics(window) {
+  }
+
+  double operator()(double x, bool& valid) {
+    statistics.push(x, valid);
+    valid = statistics.count() > 0;
+    return statistics.median();
+  }
+};
+
+// online hampel identifier: a sample further than k scaled MADs from the median of the window ending
+// at it is replaced by that median, all others pass unchanged and without delay; the MAD is estimated
+// as half the interquartile range, exact for symmetric distributions and O(log window) unlike the
+// median of absolute deviations
+class HampelKernel {
+  RollingOrderStatistics statistics;
+  double k;
+
+public:
+  HampelKernel(size_t window, double k_) : statistics(window), k(k_) {
+  }
+
+  double operator()(double x, bool& valid) {
+    statistics.push(x, valid);
+    if(!valid) {
+      return x;
+    }
+    double median = statistics.median();
+    double mad = (statistics.quantile(0.75) - statistics.quantile(0.25)) / 2;
+    return std::fabs(x - median) > k * 1.4826 * mad ? median : x;
+  }
+};
+
+// runs one kernel per sensor channel, the channels in parallel
+template <class Kernel>
+class ChannelParallelStage : public Stage {
+  std::vector<Kernel> kernels;
+
+public:
+  ChannelParallelStage(const Kernel& kernel) : kernels(channelCount, kernel) {
+  }
+
+  void process(SampleBlock& block) override {
+    threadPool().parallelFor(channelCount, [&](size_t c) {
+      auto& kernel = kernels[c];
+      auto& column = block.columns[c];
+      auto& mask = block.valid[c];
+      for(size_t i = 0; i < block.size(); ++i) {
+        bool valid = isSet(mask, i);
+        column[i] = kernel(column[i], valid);
+        setBit(mask, i, valid);
+      }
+    });
+  }
+};
+
+// batch mode over whole columns, NaN marks invalid samples
+template <class Kernel>
+void filterColumns(std::vector<std::vector<double>>& columns, const Kernel& kernel) {
+  threadPool().parallelFor(columns.size(), [&](size_t c) {
+    Kernel channelKernel = kernel;
+    for(auto& x : columns[c]) {
+      bool valid = !std::isnan(x);
+      x = channelKernel(x, valid);
+      x = valid ? x : std::numeric_limits<double>::quiet_NaN();
+    }
+  });
+}
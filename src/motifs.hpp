@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "parallel.hpp"
+#include "tempo.hpp"
+
+// z normalized euclidean distance of every subsequence of length m to its nearest non trivial match
+struct MatrixProfile {
+  std::vector<float> distance;  // infinity where no row reached the subsequence
+  std::vector<int32_t> nearest;  // start of the match, -1 if there is none
+  size_t exclusion;  // matches closer than this to the subsequence itself are trivial
+};
+
+// dot products of t[start, start + m) with every subsequence t[j, j + m) in O(n log n), the spectrum of
+// the series is computed once for all queries
+class SlidingDotProducts {
+  const std::vector<double>& t;
+  size_t m, size = 1;
+  std::vector<std::complex<double>> spectrum;
+
+public:
+  SlidingDotProducts(const std::vector<double>& t_, size_t m_) : t(t_), m(m_) {
+    while(size < t.size() + m) {
+      size <<= 1;
+    }
+    spectrum.resize(size);
+    std::copy(t.begin(), t.end(), spectrum.begin());
+    fft(spectrum);
+  }
+
+  std::vector<double> operator()(size_t start) const {
+    std::vector<std::complex<double>> query(size);
+    for(size_t k = 0; k < m; ++k) {
+      query[k] = t[start + m - 1 - k];
+    }
+    fft(query);
+    for(size_t k = 0; k < size; ++k) {
+      query[k] *= spectrum[k];
+    }
+    fft(query, true);
+    std::vector<double> products(t.size() - m + 1);
+    for(size_t j = 0; j < products.size(); ++j) {
+      products[j] = query[j + m - 1].real() / size;
+    }
+    return products;
+  }
+};
+
+// stomp: rows of the distance matrix are derived from the previous one in O(n), only the upper triangle
+// is computed and updates the profile of both subsequences; rows are split into chunks that threads
+// take in random order, each chunk starts with one fft, and with a fraction below 1 only that share of
+// the chunks runs, an anytime approximation that converges to the exact profile
+inline MatrixProfile matrixProfile(const std::vector<double>& t, size_t m, double fraction = 1, unsigned seed = 42) {
+  MatrixProfile profile;
+  profile.exclusion = std::max(m / 4, (size_t) 1);
+  if(m < 2 || t.size() < m + profile.exclusion) {
+    return profile;
+  }
+  size_t count = t.size() - m + 1;
+
+  // window means and inverse standard deviations from prefix sums, flat windows correlate with nothing
+  std::vector<double> mean(count), inverseDeviation(count);
+  double sum = std::accumulate(t.begin(), t.begin() + m, 0.), squares = 0;
+  for(size_t k = 0; k < m; ++k) {
+    squares += t[k] * t[k];
+  }
+  for(size_t i = 0; i < count; ++i) {
+    if(i > 0) {
+      sum += t[i + m - 1] - t[i - 1];
+      squares += t[i + m - 1] * t[i + m - 1] - t[i - 1] * t[i - 1];
+    }
+    mean[i] = sum / m;
+    double variance = squares / m - mean[i] * mean[i];
+    inverseDeviation[i] = variance > 1e-12 ? 1 / std::sqrt(variance) : 0;
+  }
+
+  SlidingDotProducts dotProducts(t, m);
+  ThreadPool& pool = threadPool();
+  size_t chunkRows = std::max(count / (pool.size() * 16), (size_t) 1);
+  std::vector<size_t> chunks((count + chunkRows - 1) / chunkRows);
+  std::iota(chunks.begin(), chunks.end(), 0);
+  std::mt19937 random(seed);
+  std::shuffle(chunks.begin(), chunks.end(), random);
+  chunks.resize(std::max((size_t) std::ceil(fraction * chunks.size()), (size_t) 1));
+
+  // every thread keeps its own squared profile, merged at the end
+  constexpr float infinity = std::numeric_limits<float>::infinity();
+  std::vector<std::vector<float>> squared(pool.size());
+  std::vector<std::vector<int32_t>> nearest(pool.size());
+  std::atomic<size_t> next(0);
+  pool.parallelFor(pool.size(), [&](size_t slot) {
+    std::vector<float>& p = squared[slot];
+    std::vector<int32_t>& index = nearest[slot];
+    p.assign(count, infinity);
+    index.assign(count, -1);
+    std::vector<double> previous, current(count);
+    std::vector<float> row(count);
+    for(size_t c; (c = next++) < chunks.size();) {
+      size_t from = chunks[c] * chunkRows, to = std::min(from + chunkRows, count);
+      for(size_t i = from; i < to; ++i) {
+        if(i == from) {
+          current = dotProducts(i);
+        } else {
+          std::swap(previous, current);
+          current.resize(count);
+          double drop = t[i - 1], add = t[i + m - 1];
+          for(size_t j = i + profile.exclusion; j < count; ++j) {
+            current[j] = previous[j - 1] - drop * t[j - 1] + add * t[j + m - 1];
+          }
+        }
+        size_t first = i + profile.exclusion;
+        if(first >= count) {
+          continue;
+        }
+        for(size_t j = first; j < count; ++j) {
+          double correlation = (current[j] - m * mean[i] * mean[j]) * inverseDeviation[i] * inverseDeviation[j] / m;
+          row[j] = 2 * m * (1 - std::min(std::max(correlation, -1.), 1.));
+        }
+        for(size_t j = first; j < count; ++j) {
+          bool closer = row[j] < p[j];
+          p[j] = closer ? row[j] : p[j];
+          index[j] = closer ? (int32_t) i : index[j];
+        }
+        // minimum of the row in independent lanes, its position is only searched for
+        // if it improves the profile, which gets rare once the profile converged
+        float lanes[16];
+        std::fill(lanes, lanes + 16, infinity);
+        size_t j = first;
+        for(; j + 16 <= count; j += 16) {
+          for(int l = 0; l < 16; ++l) {
+            lanes[l] = std::min(lanes[l], row[j + l]);
+          }
+        }
+        float rowMinimum = *std::min_element(lanes, lanes + 16);
+        for(; j < count; ++j) {
+          rowMinimum = std::min(rowMinimum, row[j]);
+        }
+        if(rowMinimum < p[i]) {
+          p[i] = rowMinimum;
+          index[i] = std::find(row.begin() + first, row.begin() + count, rowMinimum) - row.begin();
+        }
+      }
+    }
+  });
+
+  profile.distance.assign(count, infinity);
+  profile.nearest.assign(count, -1);
+  for(size_t slot = 0; slot < pool.size(); ++slot) {
+    for(size_t i = 0; i < count; ++i) {
+      if(squared[slot][i] < profile.distance[i]) {
+        profile.distance[i] = squared[slot][i];
+        profile.nearest[i] = nearest[slot][i];
+      }
+    }
+  }
+  for(float& d : profile.distance) {
+    d = std::sqrt(d);
+  }
+  return profile;
+}
+
+// starts of the lowest (motifs) or highest (discords) profile values, at least the exclusion zone apart
+inline std::vector<size_t> profileExtremes(const MatrixProfile& profile, size_t k, bool highest) {
+  std::vector<size_t> order;
+  for(size_t i = 0; i < profile.distance.size(); ++i) {
+    if(profile.nearest[i] >= 0) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return highest ? profile.distance[a] > profile.distance[b] : profile.distance[a] < profile.distance[b];
+  });
+  std::vector<size_t> chosen;
+  auto near = [&](size_t a, size_t b) { return (a > b ? a - b : b - a) < profile.exclusion; };
+  for(size_t i : order) {
+    if(chosen.size() == k) {
+      break;
+    }
+    bool overlaps = false;
+    for(size_t c : chosen) {
+      overlaps |= near(i, c) || (!highest && near(profile.nearest[i], c));
+    }
+    if(!overlaps) {
+      chosen.push_back(i);
+    }
+  }
+  return chosen;
+}
+
+// collects one channel, invalid samples hold the last valid value, and writes its matrix profile to
+// one table and the top motifs and discords to another once the stream ended
+class MatrixProfileStage : public Stage {
+  static constexpr size_t extremes = 3;
+  int channel;
+  size_t m;
+  double fraction;
+  std::string profileFile, motifFile;
+  std::vector<double> values;
+  std::vector<int> t;
+  double lastValid = 0;
+
+public:
+  MatrixProfileStage(const std::string& profileFile_, const std::string& motifFile_, int channel_, size_t m_,
+                     double fraction_)
+      : channel(channel_), m(m_), fraction(fraction_), profileFile(profileFile_), motifFile(motifFile_) {
+  }
+
+  void process(SampleBlock& block) override {
+    for(size_t i = 0; i < block.size(); ++i) {
+      lastValid = isSet(block.valid[channel], i) ? block.columns[channel][i] : lastValid;
+      values.push_back(lastValid);
+      t.push_back(block.t[i]);
+    }
+  }
+
+  void finish() override {
+    MatrixProfile profile = matrixProfile(values, m, fraction);
+    std::ofstream table(profileFile);
+    table << "#t,distance,nearest" << std::endl;
+    for(size_t i = 0; i < profile.distance.size(); ++i) {
+      if(profile.nearest[i] >= 0) {
+        table << t[i] << "\t" << profile.distance[i] << "\t" << t[profile.nearest[i]] << "\n";
+      }
+    }
+
+    std::ofstream motifs(motifFile);
+    motifs << "#kind,rank,t,nearest,distance" << std::endl;
+    for(bool discords : {false, true}) {
+      int rank = 0;
+      for(size_t i : profileExtremes(profile, extremes, discords)) {
+        motifs << (discords ? "discord" : "motif") << "\t" << rank++ << "\t" << t[i] << "\t" << t[profile.nearest[i]]
+               << "\t" << profile.distance[i] << "\n";
+      }
+    }
+  }
+};
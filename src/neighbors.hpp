@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "features.hpp"
+
+// (squared distance, point index) in ascending order
+using Neighbors = std::vector<std::pair<float, uint32_t>>;
+
+inline float squaredDistance(const float* a, const float* b, int dimensions) {
+  float sum = 0;
+  for(int d = 0; d < dimensions; ++d) {
+    sum += (a[d] - b[d]) * (a[d] - b[d]);
+  }
+  return sum;
+}
+
+// exact k nearest neighbours; the points are stored column by column so the distance loop runs over
+// points without reordering the sum of a single distance
+class BruteForceIndex {
+  int dimensions;
+  size_t count = 0;
+  std::vector<std::vector<float>> columns;
+  mutable std::vector<float> distances;
+
+public:
+  BruteForceIndex(int dimensions_) : dimensions(dimensions_), columns(dimensions_) {
+  }
+
+  void add(const float* point) {
+    for(int d = 0; d < dimensions; ++d) {
+      columns[d].push_back(point[d]);
+    }
+    ++count;
+  }
+
+  Neighbors search(const float* query, size_t k) const {
+    distances.assign(count, 0);
+    for(int d = 0; d < dimensions; ++d) {
+      const float* column = columns[d].data();
+      float q = query[d];
+      for(size_t i = 0; i < count; ++i) {
+        distances[i] += (column[i] - q) * (column[i] - q);
+      }
+    }
+    Neighbors result(count);
+    for(size_t i = 0; i < count; ++i) {
+      result[i] = {distances[i], (uint32_t) i};
+    }
+    k = std::min(k, count);
+    std::partial_sort(result.begin(), result.begin() + k, result.end());
+    result.resize(k);
+    return result;
+  }
+};
+
+// approximate k nearest neighbours with a hierarchical navigable small world graph: every point is linked
+// to its m nearest (2 m on the bottom layer) on each layer up to a random one, searches descend greedily
+// from the sparse top layer and widen to a beam of ef candidates on the bottom one; searches are not
+// thread safe
+class HnswIndex {
+  int dimensions, m, efConstruction;
+  std::vector<float> points;
+  std::vector<std::vector<std::vector<uint32_t>>> links;  // point, layer, neighbours
+  int entry = -1, topLayer = -1;
+  std::mt19937 random{42};
+  // points visited by the current search carry its generation, saves clearing a set per search
+  mutable std::vector<uint32_t> visited;
+  mutable uint32_t generation = 0;
+
+  const float* point(uint32_t i) const {
+    return points.data() + (size_t) i * dimensions;
+  }
+
+  size_t maxLinks(int layer) const {
+    return layer == 0 ? 2 * m : m;
+  }
+
+  Neighbors searchLayer(const float* query, uint32_t start, size_t ef, int layer) const {
+    using Candidate = std::pair<float, uint32_t>;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+    std::priority_queue<Candidate> nearest;
+    visited.resize(size());
+    if(++generation == 0) {
+      std::fill(visited.begin(), visited.end(), 0);
+      generation = 1;
+    }
+    visited[start] = generation;
+    float d = squaredDistance(query, point(start), dimensions);
+    candidates.emplace(d, start);
+    nearest.emplace(d, start);
+    while(!candidates.empty()) {
+      Candidate c = candidates.top();
+      if(c.first > nearest.top().first && nearest.size() >= ef) {
+        break;
+      }
+      candidates.pop();
+      for(uint32_t next : links[c.second][layer]) {
+        if(visited[next] == generation) {
+          continue;
+        }
+        visited[next] = generation;
+        d = squaredDistance(query, point(next), dimensions);
+        if(nearest.size() < ef || d < nearest.top().first) {
+          candidates.emplace(d, next);
+          nearest.emplace(d, next);
+          if(nearest.size() > ef) {
+            nearest.pop();
+          }
+        }
+      }
+    }
+    Neighbors result(nearest.size());
+    for(size_t i = result.size(); i-- > 0; nearest.pop()) {
+      result[i] = nearest.top();
+    }
+    return result;
+  }
+
+  uint32_t greedy(const float* query, uint32_t start, int fromLayer, int toLayer) const {
+    for(int layer = fromLayer; layer > toLayer; --layer) {
+      start = searchLayer(query, start, 1, layer)[0].second;
+    }
+    return start;
+  }
+
+  // keeps the nearest maxLinks of a point's neighbours on a layer
+  void prune(uint32_t i, int layer) {
+    auto& neighbours = links[i][layer];
+    if(neighbours.size() <= maxLinks(layer)) {
+      return;
+    }
+    Neighbors byDistance;
+    for(uint32_t j : neighbours) {
+      byDistance.emplace_back(squaredDistance(point(i), point(j), dimensions), j);
+    }
+    std::partial_sort(byDistance.begin(), byDistance.begin() + maxLinks(layer), byDistance.end());
+    neighbours.resize(maxLinks(layer));
+    for(size_t k = 0; k < neighbours.size(); ++k) {
+      neighbours[k] = byDistance[k].second;
+    }
+  }
+
+public:
+  HnswIndex(int dimensions_, int m_ = 16, int efConstruction_ = 100)
+      : dimensions(dimensions_), m(m_), efConstruction(efConstruction_) {
+  }
+
+  size_t size() const {
+    return links.size();
+  }
+
+  void add(const float* p) {
+    uint32_t i = size();
+    points.insert(points.end(), p, p + dimensions);
+    int layer = -std::log(std::uniform_real_distribution<double>(1e-12, 1)(random)) / std::log(m);
+    links.emplace_back(layer + 1);
+    if(entry < 0) {
+      entry = i;
+      topLayer = layer;
+      return;
+    }
+    uint32_t start = greedy(p, entry, topLayer, layer);
+    for(int l = std::min(layer, topLayer); l >= 0; --l) {
+      Neighbors nearest = searchLayer(p, start, efConstruction, l);
+      start = nearest[0].second;
+      nearest.resize(std::min(nearest.size(), (size_t) m));
+      for(const auto& neighbour : nearest) {
+        links[i][l].push_back(neighbour.second);
+        links[neighbour.second][l].push_back(i);
+        prune(neighbour.second, l);
+      }
+    }
+    if(layer > topLayer) {
+      entry = i;
+      topLayer = layer;
+    }
+  }
+
+  Neighbors search(const float* query, size_t k, size_t ef) const {
+    if(entry < 0) {
+      return {};
+    }
+    Neighbors result = searchLayer(query, greedy(query, entry, topLayer, 0), std::max(ef, k), 0);
+    result.resize(std::min(result.size(), k));
+    return result;
+  }
+
+  void save(std::ostream& output) const {
+    int32_t header[5] = {dimensions, m, entry, topLayer, (int32_t) size()};
+    output.write((const char*) header, sizeof(header));
+    output.write((const char*) points.data(), points.size() * sizeof(float));
+    for(const auto& layers : links) {
+      uint32_t layerCount = layers.size();
+      output.write((const char*) &layerCount, sizeof(layerCount));
+      for(const auto& neighbours : layers) {
+        uint32_t linkCount = neighbours.size();
+        output.write((const char*) &linkCount, sizeof(linkCount));
+        output.write((const char*) neighbours.data(), linkCount * sizeof(uint32_t));
+      }
+    }
+  }
+
+  bool load(std::istream& input) {
+    int32_t header[5];
+    if(!input.read((char*) header, sizeof(header)) || header[0] != dimensions) {
+      return false;
+    }
+    m = header[1];
+    entry = header[2];
+    topLayer = header[3];
+    points.resize((size_t) header[4] * dimensions);
+    input.read((char*) points.data(), points.size() * sizeof(float));
+    links.assign(header[4], {});
+    for(auto& layers : links) {
+      uint32_t layerCount = 0;
+      input.read((char*) &layerCount, sizeof(layerCount));
+      layers.resize(layerCount);
+      for(auto& neighbours : layers) {
+        uint32_t linkCount = 0;
+        input.read((char*) &linkCount, sizeof(linkCount));
+        neighbours.resize(linkCount);
+        input.read((char*) neighbours.data(), linkCount * sizeof(uint32_t));
+      }
+    }
+    return (bool) input;
+  }
+};
+
+// nearest archive strokes of a feature vector, over features z normalized on the archive; small archives
+// are searched exactly, from exactLimit strokes on through an hnsw graph that is cached in a file and
+// only rebuilt if the archive changed
+class StrokeIndex {
+  std::vector<ArchiveStroke> strokes;
+  FeatureNormalization normalization;
+  BruteForceIndex exact{featureCount};
+  HnswIndex approximate{featureCount};
+  bool useApproximate;
+
+  // fnv-1a over the archive features, identifies the archive a cached graph was built from
+  uint64_t fingerprint() const {
+    uint64_t hash = 1469598103934665603ull;
+    for(const auto& stroke : strokes) {
+      const unsigned char* bytes = (const unsigned char*) &stroke.features;
+      for(size_t b = 0; b < sizeof(StrokeFeatures); ++b) {
+        hash = (hash ^ bytes[b]) * 1099511628211ull;
+      }
+    }
+    return hash;
+  }
+
+public:
+  static constexpr size_t exactLimit = 10000;
+
+  StrokeIndex(const std::vector<ArchiveStroke>& strokes_, const std::string& cacheFile)
+      : strokes(strokes_), normalization(strokes) {
+    useApproximate = strokes.size() >= exactLimit;
+    if(!useApproximate) {
+      for(const auto& stroke : strokes) {
+        float p[featureCount];
+        normalization.apply(stroke.features.v, p);
+        exact.add(p);
+      }
+      return;
+    }
+    uint64_t hash = fingerprint(), cachedHash = 0;
+    std::ifstream cache(cacheFile, std::ios::binary);
+    if(cache.read((char*) &cachedHash, sizeof(cachedHash)) && cachedHash == hash && approximate.load(cache) &&
+       approximate.size() == strokes.size()) {
+      return;
+    }
+    approximate = HnswIndex(featureCount);
+    for(const auto& stroke : strokes) {
+      float p[featureCount];
+      normalization.apply(stroke.features.v, p);
+      approximate.add(p);
+    }
+    std::ofstream output(cacheFile, std::ios::binary);
+    output.write((const char*) &hash, sizeof(hash));
+    approximate.save(output);
+  }
+
+  const ArchiveStroke& stroke(uint32_t i) const {
+    return strokes[i];
+  }
+
+  // k nearest strokes, distances are in normalized units
+  Neighbors search(const float* features, size_t k) const {
+    float query[featureCount];
+    normalization.apply(features, query);
+    Neighbors result = useApproximate ? approximate.search(query, k, std::max(k, (size_t) 64)) : exact.search(query, k);
+    for(auto& neighbour : result) {
+      neighbour.first = std::sqrt(neighbour.first);
+    }
+    return result;
+  }
+};
+
+// looks up the k nearest archive strokes of every stroke
+class NeighborStage : public StrokeFeatureExtractor {
+  StrokeIndex index;
+  std::vector<std::string> archiveFiles;
+  size_t k;
+  std::ofstream table;
+
+  void done(const std::vector<StrokeFeatures>& features) override {
+    for(const auto& stroke : features) {
+      int rank = 0;
+      for(const auto& neighbour : index.search(stroke.v, k)) {
+        const ArchiveStroke& match = index.stroke(neighbour.second);
+        table << stroke.stroke << "\t" << stroke.start << "\t" << stroke.end << "\t" << rank++ << "\t"
+              << archiveFiles[match.file] << "\t" << match.features.stroke << "\t" << neighbour.first << "\n";
+      }
+    }
+  }
+
+public:
+  NeighborStage(const std::string& tableFile, const std::string& indexFile, const std::vector<ArchiveStroke>& archive,
+                const std::vector<std::string>& archiveFiles_, size_t k_, double sampleRate, double startThreshold,
+                double endThreshold)
+      : StrokeFeatureExtractor(sampleRate, startThreshold, endThreshold),
+        index(archive, indexFile),
+        archiveFiles(archiveFiles_),
+        k(k_),
+        table(tableFile) {
+    table << "#stroke,start,end,rank,archive,archiveStroke,distance" << std::endl;
+  }
+
+  void finish() override {
+    StrokeFeatureExtractor::finish();
+    table.flush();
+  }
+};
@@ -0,0 +1,625 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "filters.hpp"
+#include "parallel.hpp"
+
+constexpr double degree = M_PI / 180;
+
+struct Quaternion {
+  double w, x, y, z;
+};
+
+inline Quaternion operator*(const Quaternion& a, const Quaternion& b) {
+  return {a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+          a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+          a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+          a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w};
+}
+
+inline Quaternion conjugate(const Quaternion& q) {
+  return {q.w, -q.x, -q.y, -q.z};
+}
+
+// rotates v from the sensor frame into the frame q is relative to
+inline Vec3 rotate(const Quaternion& q, const Vec3& v) {
+  Quaternion r = q * Quaternion{0, v.x, v.y, v.z} * conjugate(q);
+  return {r.x, r.y, r.z};
+}
+
+// rotation matrices of a column of samples, element (row, col) of sample i is m[3 * row + col][i]
+struct RotationColumns {
+  std::vector<double> m[9];
+
+  void resize(size_t n) {
+    for(auto& element : m) {
+      element.resize(n);
+    }
+  }
+};
+
+// sensor euler angles in degrees (roll x, pitch y, yaw z) to the sensor to world matrix Rz Ry Rx, row major
+inline void eulerToMatrix(double roll, double pitch, double yaw, double* m) {
+  double sx = std::sin(roll * degree), cx = std::cos(roll * degree);
+  double sy = std::sin(pitch * degree), cy = std::cos(pitch * degree);
+  double sz = std::sin(yaw * degree), cz = std::cos(yaw * degree);
+  m[0] = cy * cz;
+  m[1] = sx * sy * cz - cx * sz;
+  m[2] = cx * sy * cz + sx * sz;
+  m[3] = cy * sz;
+  m[4] = sx * sy * sz + cx * cz;
+  m[5] = cx * sy * sz - sx * cz;
+  m[6] = -sy;
+  m[7] = sx * cy;
+  m[8] = cx * cy;
+}
+
+// row major rotation matrix to euler angles in degrees, the inverse of eulerToMatrix
+inline void matrixToEuler(const double* m, double& roll, double& pitch, double& yaw) {
+  roll = std::atan2(m[7], m[8]) / degree;
+  pitch = -std::asin(std::min(std::max(m[6], -1.), 1.)) / degree;
+  yaw = std::atan2(m[3], m[0]) / degree;
+}
+
+// eulerToMatrix for n samples
+inline void eulerToMatrices(const double* roll, const double* pitch, const double* yaw, size_t n, RotationColumns& r) {
+  r.resize(n);
+  for(size_t i = 0; i < n; ++i) {
+    double m[9];
+    eulerToMatrix(roll[i], pitch[i], yaw[i], m);
+    for(int k = 0; k < 9; ++k) {
+      r.m[k][i] = m[k];
+    }
+  }
+}
+
+// unit quaternions to rotation matrices
+inline void quaternionsToMatrices(const double* w, const double* x, const double* y, const double* z, size_t n,
+                                  RotationColumns& r) {
+  r.resize(n);
+  double* m[9];
+  for(int k = 0; k < 9; ++k) {
+    m[k] = r.m[k].data();
+  }
+  for(size_t i = 0; i < n; ++i) {
+    m[0][i] = 1 - 2 * (y[i] * y[i] + z[i] * z[i]);
+    m[1][i] = 2 * (x[i] * y[i] - w[i] * z[i]);
+    m[2][i] = 2 * (x[i] * z[i] + w[i] * y[i]);
+    m[3][i] = 2 * (x[i] * y[i] + w[i] * z[i]);
+    m[4][i] = 1 - 2 * (x[i] * x[i] + z[i] * z[i]);
+    m[5][i] = 2 * (y[i] * z[i] - w[i] * x[i]);
+    m[6][i] = 2 * (x[i] * z[i] - w[i] * y[i]);
+    m[7][i] = 2 * (y[i] * z[i] + w[i] * x[i]);
+    m[8][i] = 1 - 2 * (x[i] * x[i] + y[i] * y[i]);
+  }
+}
+
+// sensor euler angles in degrees to the unit quaternions of the same rotation Rz Ry Rx
+inline void eulerToQuaternions(const double* roll, const double* pitch, const double* yaw, size_t n, double* w,
+                               double* x, double* y, double* z) {
+  for(size_t i = 0; i < n; ++i) {
+    double sx = std::sin(roll[i] * degree / 2), cx = std::cos(roll[i] * degree / 2);
+    double sy = std::sin(pitch[i] * degree / 2), cy = std::cos(pitch[i] * degree / 2);
+    double sz = std::sin(yaw[i] * degree / 2), cz = std::cos(yaw[i] * degree / 2);
+    w[i] = cx * cy * cz + sx * sy * sz;
+    x[i] = sx * cy * cz - cx * sy * sz;
+    y[i] = cx * sy * cz + sx * cy * sz;
+    z[i] = cx * cy * sz - sx * sy * cz;
+  }
+}
+
+// unit quaternions to sensor euler angles in degrees, pitch in [-90, 90]
+inline void quaternionsToEuler(const double* w, const double* x, const double* y, const double* z, size_t n,
+                               double* roll, double* pitch, double* yaw) {
+  for(size_t i = 0; i < n; ++i) {
+    roll[i] = std::atan2(2 * (w[i] * x[i] + y[i] * z[i]), 1 - 2 * (x[i] * x[i] + y[i] * y[i])) / degree;
+    pitch[i] = std::asin(std::min(std::max(2 * (w[i] * y[i] - z[i] * x[i]), -1.), 1.)) / degree;
+    yaw[i] = std::atan2(2 * (w[i] * z[i] + x[i] * y[i]), 1 - 2 * (y[i] * y[i] + z[i] * z[i])) / degree;
+  }
+}
+
+// rotation matrices Rz Ry Rx to sensor euler angles in degrees
+inline void matricesToEuler(const RotationColumns& r, size_t n, double* roll, double* pitch, double* yaw) {
+  const double* m[9];
+  for(int k = 0; k < 9; ++k) {
+    m[k] = r.m[k].data();
+  }
+  for(size_t i = 0; i < n; ++i) {
+    double row[9];
+    for(int k = 0; k < 9; ++k) {
+      row[k] = m[k][i];
+    }
+    matrixToEuler(row, roll[i], pitch[i], yaw[i]);
+  }
+}
+
+// rotation matrices to unit quaternions with w >= 0; shepperd's method, the component with the largest
+// square comes from the diagonal and the others from off diagonal sums and differences divided by it,
+// so half turns keep their relative signs
+inline void matricesToQuaternions(const RotationColumns& r, size_t n, double* w, double* x, double* y, double* z) {
+  const double* m[9];
+  for(int k = 0; k < 9; ++k) {
+    m[k] = r.m[k].data();
+  }
+  for(size_t i = 0; i < n; ++i) {
+    // four times the square of w, x, y and z
+    double tw = 1 + m[0][i] + m[4][i] + m[8][i], tx = 1 + m[0][i] - m[4][i] - m[8][i];
+    double ty = 1 - m[0][i] + m[4][i] - m[8][i], tz = 1 - m[0][i] - m[4][i] + m[8][i];
+    double t = std::max(std::max(tw, tx), std::max(ty, tz));
+    double largest = 0.5 * std::sqrt(t), f = 0.25 / largest;
+    double xw = (m[7][i] - m[5][i]) * f, yw = (m[2][i] - m[6][i]) * f, zw = (m[3][i] - m[1][i]) * f;
+    double xy = (m[1][i] + m[3][i]) * f, xz = (m[2][i] + m[6][i]) * f, yz = (m[5][i] + m[7][i]) * f;
+    bool isW = t == tw, isX = !isW & (t == tx), isY = !isW & !isX & (t == ty);
+    double qw = isW ? largest : isX ? xw : isY ? yw : zw;
+    double qx = isW ? xw : isX ? largest : isY ? xy : xz;
+    double qy = isW ? yw : isX ? xy : isY ? largest : yz;
+    double qz = isW ? zw : isX ? xz : isY ? yz : largest;
+    double sign = qw < 0 ? -1 : 1;
+    w[i] = sign * qw;
+    x[i] = sign * qx;
+    y[i] = sign * qy;
+    z[i] = sign * qz;
+  }
+}
+
+// out = R v for every sample, out may alias v
+inline void rotateColumns(const RotationColumns& r, const double* x, const double* y, const double* z, size_t n,
+                          double* outX, double* outY, double* outZ) {
+  const double* m[9];
+  for(int k = 0; k < 9; ++k) {
+    m[k] = r.m[k].data();
+  }
+  for(size_t i = 0; i < n; ++i) {
+    double vx = x[i], vy = y[i], vz = z[i];
+    outX[i] = m[0][i] * vx + m[1][i] * vy + m[2][i] * vz;
+    outY[i] = m[3][i] * vx + m[4][i] * vy + m[5][i] * vz;
+    outZ[i] = m[6][i] * vx + m[7][i] * vy + m[8][i] * vz;
+  }
+}
+
+// one gyro and accelerometer sample per lane, gyro in rad/s, acceleration in any unit;
+// lanes are independent sensors or the same sensor with different gains
+template <int lanes>
+struct ImuSamples {
+  double gx[lanes], gy[lanes], gz[lanes];
+  double ax[lanes], ay[lanes], az[lanes];
+  double gyroValid[lanes], accelerationValid[lanes];  // 0 or 1
+};
+
+// orientation of every lane
+template <int lanes>
+class QuaternionLanes {
+protected:
+  double q0[lanes], q1[lanes], q2[lanes], q3[lanes];
+  bool started[lanes] = {false};
+
+  // the first valid acceleration gives roll and pitch, yaw starts at 0
+  void start(const ImuSamples<lanes>& s) {
+    for(int l = 0; l < lanes; ++l) {
+      if(!started[l] && s.accelerationValid[l] && s.ax[l] * s.ax[l] + s.ay[l] * s.ay[l] + s.az[l] * s.az[l] > 0) {
+        double roll = std::atan2(s.ay[l], s.az[l]);
+        double pitch = std::atan2(-s.ax[l], std::sqrt(s.ay[l] * s.ay[l] + s.az[l] * s.az[l]));
+        q0[l] = std::cos(roll / 2) * std::cos(pitch / 2);
+        q1[l] = std::sin(roll / 2) * std::cos(pitch / 2);
+        q2[l] = std::cos(roll / 2) * std::sin(pitch / 2);
+        q3[l] = -std::sin(roll / 2) * std::sin(pitch / 2);
+        started[l] = true;
+      }
+    }
+  }
+
+  static double inverseNorm(double squaredNorm) {
+    return squaredNorm > 0 ? 1 / std::sqrt(squaredNorm) : 0;
+  }
+
+public:
+  QuaternionLanes() {
+    for(int l = 0; l < lanes; ++l) {
+      q0[l] = 1;
+      q1[l] = q2[l] = q3[l] = 0;
+    }
+  }
+
+  bool isStarted(int lane) const {
+    return started[lane];
+  }
+
+  Quaternion quaternion(int lane) const {
+    return {q0[lane], q1[lane], q2[lane], q3[lane]};
+  }
+};
+
+// madgwick gradient descent imu filter (gyro and accelerometer, no magnetometer)
+template <int lanes>
+class MadgwickFilter : public QuaternionLanes<lanes> {
+  using QuaternionLanes<lanes>::q0;
+  using QuaternionLanes<lanes>::q1;
+  using QuaternionLanes<lanes>::q2;
+  using QuaternionLanes<lanes>::q3;
+  using QuaternionLanes<lanes>::started;
+  using QuaternionLanes<lanes>::inverseNorm;
+  double beta[lanes];
+
+public:
+  MadgwickFilter(const double* beta_) {
+    for(int l = 0; l < lanes; ++l) {
+      beta[l] = beta_[l];
+    }
+  }
+
+  void update(const ImuSamples<lanes>& s, double dt) {
+    this->start(s);
+    for(int l = 0; l < lanes; ++l) {
+      double gx = s.gx[l], gy = s.gy[l], gz = s.gz[l];
+      double dot0 = 0.5 * (-q1[l] * gx - q2[l] * gy - q3[l] * gz);
+      double dot1 = 0.5 * (q0[l] * gx + q2[l] * gz - q3[l] * gy);
+      double dot2 = 0.5 * (q0[l] * gy - q1[l] * gz + q3[l] * gx);
+      double dot3 = 0.5 * (q0[l] * gz + q1[l] * gy - q2[l] * gx);
+
+      // corrective step towards gravity, weight 0 without a valid acceleration
+      double r = s.accelerationValid[l] * inverseNorm(s.ax[l] * s.ax[l] + s.ay[l] * s.ay[l] + s.az[l] * s.az[l]);
+      double ax = s.ax[l] * r, ay = s.ay[l] * r, az = s.az[l] * r;
+      double _2q0 = 2 * q0[l], _2q1 = 2 * q1[l], _2q2 = 2 * q2[l], _2q3 = 2 * q3[l];
+      double _4q0 = 4 * q0[l], _4q1 = 4 * q1[l], _4q2 = 4 * q2[l];
+      double _8q1 = 8 * q1[l], _8q2 = 8 * q2[l];
+      double q0q0 = q0[l] * q0[l], q1q1 = q1[l] * q1[l], q2q2 = q2[l] * q2[l], q3q3 = q3[l] * q3[l];
+      double s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+      double s1 = _4q1 * q3q3 - _2q3 * ax + 4 * q0q0 * q1[l] - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+      double s2 = 4 * q0q0 * q2[l] + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+      double s3 = 4 * q1q1 * q3[l] - _2q1 * ax + 4 * q2q2 * q3[l] - _2q2 * ay;
+      double step = (r > 0) * beta[l] * inverseNorm(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+      dot0 -= step * s0;
+      dot1 -= step * s1;
+      dot2 -= step * s2;
+      dot3 -= step * s3;
+
+      // no update without a valid gyro sample
+      double w = s.gyroValid[l] * started[l] * dt;
+      double n0 = q0[l] + dot0 * w, n1 = q1[l] + dot1 * w, n2 = q2[l] + dot2 * w, n3 = q3[l] + dot3 * w;
+      double norm = inverseNorm(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+      q0[l] = n0 * norm;
+      q1[l] = n1 * norm;
+      q2[l] = n2 * norm;
+      q3[l] = n3 * norm;
+    }
+  }
+};
+
+// mahony complementary imu filter with proportional and integral feedback
+template <int lanes>
+class MahonyFilter : public QuaternionLanes<lanes> {
+  using QuaternionLanes<lanes>::q0;
+  using QuaternionLanes<lanes>::q1;
+  using QuaternionLanes<lanes>::q2;
+  using QuaternionLanes<lanes>::q3;
+  using QuaternionLanes<lanes>::started;
+  using QuaternionLanes<lanes>::inverseNorm;
+  double kp[lanes], ki[lanes];
+  double integralX[lanes] = {0}, integralY[lanes] = {0}, integralZ[lanes] = {0};
+
+public:
+  MahonyFilter(const double* kp_, const double* ki_) {
+    for(int l = 0; l < lanes; ++l) {
+      kp[l] = kp_[l];
+      ki[l] = ki_[l];
+    }
+  }
+
+  void update(const ImuSamples<lanes>& s, double dt) {
+    this->start(s);
+    for(int l = 0; l < lanes; ++l) {
+      double gx = s.gx[l], gy = s.gy[l], gz = s.gz[l];
+
+      // error between measured and estimated gravity, 0 without a valid acceleration
+      double r = s.accelerationValid[l] * inverseNorm(s.ax[l] * s.ax[l] + s.ay[l] * s.ay[l] + s.az[l] * s.az[l]);
+      double ax = s.ax[l] * r, ay = s.ay[l] * r, az = s.az[l] * r;
+      double halfVx = q1[l] * q3[l] - q0[l] * q2[l];
+      double halfVy = q0[l] * q1[l] + q2[l] * q3[l];
+      double halfVz = q0[l] * q0[l] - 0.5 + q3[l] * q3[l];
+      double ex = (ay * halfVz - az * halfVy) * (r > 0);
+      double ey = (az * halfVx - ax * halfVz) * (r > 0);
+      double ez = (ax * halfVy - ay * halfVx) * (r > 0);
+
+      double w = s.gyroValid[l] * started[l];
+      integralX[l] += w * 2 * ki[l] * ex * dt;
+      integralY[l] += w * 2 * ki[l] * ey * dt;
+      integralZ[l] += w * 2 * ki[l] * ez * dt;
+      gx = (gx + integralX[l] + 2 * kp[l] * ex) * 0.5 * dt * w;
+      gy = (gy + integralY[l] + 2 * kp[l] * ey) * 0.5 * dt * w;
+      gz = (gz + integralZ[l] + 2 * kp[l] * ez) * 0.5 * dt * w;
+
+      double n0 = q0[l] + (-q1[l] * gx - q2[l] * gy - q3[l] * gz);
+      double n1 = q1[l] + (q0[l] * gx + q2[l] * gz - q3[l] * gy);
+      double n2 = q2[l] + (q0[l] * gy - q1[l] * gz + q3[l] * gx);
+      double n3 = q3[l] + (q0[l] * gz + q1[l] * gy - q2[l] * gx);
+      double norm = inverseNorm(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+      q0[l] = n0 * norm;
+      q1[l] = n1 * norm;
+      q2[l] = n2 * norm;
+      q3[l] = n3 * norm;
+    }
+  }
+};
+
+// gyro (deg/s) and acceleration columns of one recording, NaN marks invalid samples
+struct ImuColumns {
+  const std::vector<double>* rotationVelocity[3];
+  const std::vector<double>* acceleration[3];
+};
+
+// orientation for many madgwick gains over a whole recording, lanes gains share one pass over the
+// data and the groups of lanes run in parallel; out[g] must hold one quaternion per sample
+inline void madgwickGainSweep(const ImuColumns& imu,
+                              const std::vector<double>& betas,
+                              double sampleRate,
+                              std::vector<std::vector<Quaternion>>& out) {
+  constexpr int lanes = 4;
+  size_t n = imu.rotationVelocity[0]->size();
+  size_t groups = (betas.size() + lanes - 1) / lanes;
+  threadPool().parallelFor(groups, [&](size_t group) {
+    double beta[lanes];
+    for(int l = 0; l < lanes; ++l) {
+      beta[l] = betas[std::min(group * lanes + l, betas.size() - 1)];
+    }
+    MadgwickFilter<lanes> filter(beta);
+    ImuSamples<lanes> s;
+    for(size_t i = 0; i < n; ++i) {
+      double g[3], a[3];
+      bool gyroValid = true, accelerationValid = true;
+      for(int k = 0; k < 3; ++k) {
+        g[k] = (*imu.rotationVelocity[k])[i] * degree;
+        a[k] = (*imu.acceleration[k])[i];
+        gyroValid = gyroValid && !std::isnan(g[k]);
+        accelerationValid = accelerationValid && !std::isnan(a[k]);
+      }
+      for(int l = 0; l < lanes; ++l) {
+        s.gx[l] = gyroValid ? g[0] : 0;
+        s.gy[l] = gyroValid ? g[1] : 0;
+        s.gz[l] = gyroValid ? g[2] : 0;
+        s.ax[l] = accelerationValid ? a[0] : 0;
+        s.ay[l] = accelerationValid ? a[1] : 0;
+        s.az[l] = accelerationValid ? a[2] : 0;
+        s.gyroValid[l] = gyroValid;
+        s.accelerationValid[l] = accelerationValid;
+      }
+      filter.update(s, 1 / sampleRate);
+      for(int l = 0; l < lanes && group * lanes + l < betas.size(); ++l) {
+        out[group * lanes + l][i] = filter.quaternion(l);
+      }
+    }
+  });
+}
+
+// appends qw, qx, qy, qz columns with the fused orientation of every sample
+template <class Filter>
+class OrientationStage : public Stage {
+  Filter filter;
+  double dt;
+  int outputs[4];
+  bool resolved = false;
+
+public:
+  OrientationStage(const Filter& filter_, double sampleRate) : filter(filter_), dt(1 / sampleRate) {
+  }
+
+  void process(SampleBlock& block) override {
+    if(!resolved) {
+      int q = 0;
+      for(const char* name : {"qw", "qx", "qy", "qz"}) {
+        outputs[q++] = block.column(name);
+      }
+      resolved = true;
+    }
+
+    ImuSamples<1> s;
+    for(size_t i = 0; i < block.size(); ++i) {
+      s.gyroValid[0] = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      s.accelerationValid[0] = isSet(block.valid[xAcc], i) && isSet(block.valid[yAcc], i) && isSet(block.valid[zAcc], i);
+      s.gx[0] = s.gyroValid[0] ? block.columns[xRot][i] * degree : 0;
+      s.gy[0] = s.gyroValid[0] ? block.columns[yRot][i] * degree : 0;
+      s.gz[0] = s.gyroValid[0] ? block.columns[zRot][i] * degree : 0;
+      s.ax[0] = s.accelerationValid[0] ? block.columns[xAcc][i] : 0;
+      s.ay[0] = s.accelerationValid[0] ? block.columns[yAcc][i] : 0;
+      s.az[0] = s.accelerationValid[0] ? block.columns[zAcc][i] : 0;
+      filter.update(s, dt);
+
+      Quaternion q = filter.quaternion(0);
+      int k = 0;
+      for(double value : {q.w, q.x, q.y, q.z}) {
+        block.columns[outputs[k]][i] = value;
+        setBit(block.valid[outputs[k++]], i, filter.isStarted(0));
+      }
+    }
+  }
+};
+
+// appends x/y/zLinearAcceleration: acceleration rotated into the world frame minus 1 g along z, the
+// orientation comes from the qw, qx, qy, qz columns of a fusion stage if there are any, else from angle;
+// acceleration has to be in g with gravity reading 1 g at rest, uncalibrated sensors leave a few
+// hundredths of a g on z (about -0.03 g on mes/steady.dat, 0 with its --calibrate file)
+class LinearAccelerationStage : public Stage {
+  int outputs[3];
+  int quaternionColumns[4];
+  bool resolved = false;
+  bool fromQuaternion;
+  RotationColumns rotations;
+
+public:
+  void process(SampleBlock& block) override {
+    if(!resolved) {
+      int k = 0;
+      for(const char* name : {"qw", "qx", "qy", "qz"}) {
+        quaternionColumns[k++] = block.find(name);
+      }
+      fromQuaternion = quaternionColumns[0] >= 0;
+      k = 0;
+      for(const char* name : {"xLinearAcceleration", "yLinearAcceleration", "zLinearAcceleration"}) {
+        outputs[k++] = block.column(name);
+      }
+      resolved = true;
+    }
+
+    size_t n = block.size();
+    int orientation[3] = {xAngle, yAngle, zAngle};
+    if(fromQuaternion) {
+      std::copy(quaternionColumns + 1, quaternionColumns + 4, orientation);
+      quaternionsToMatrices(block.columns[quaternionColumns[0]].data(), block.columns[quaternionColumns[1]].data(),
+                            block.columns[quaternionColumns[2]].data(), block.columns[quaternionColumns[3]].data(), n,
+                            rotations);
+    } else {
+      eulerToMatrices(block.columns[xAngle].data(), block.columns[yAngle].data(), block.columns[zAngle].data(), n,
+                      rotations);
+    }
+    rotateColumns(rotations, block.columns[xAcc].data(), block.columns[yAcc].data(), block.columns[zAcc].data(), n,
+                  block.columns[outputs[0]].data(), block.columns[outputs[1]].data(), block.columns[outputs[2]].data());
+    double* z = block.columns[outputs[2]].data();
+    for(size_t i = 0; i < n; ++i) {
+      z[i] -= 1;
+    }
+
+    for(size_t w = 0; w < block.words(); ++w) {
+      uint64_t valid = block.valid[xAcc][w] & block.valid[yAcc][w] & block.valid[zAcc][w];
+      for(int c : orientation) {
+        valid &= block.valid[c][w];
+      }
+      for(int output : outputs) {
+        block.valid[output][w] = valid;
+      }
+    }
+  }
+};
+
+// x/y/zLinearAcceleration columns for stages that need them: from a linear stage before if there was
+// one, else from an own LinearAccelerationStage run on every block; decided on the first block, as the
+// columns the own stage added are found on the later ones
+class LinearAccelerationColumns {
+  LinearAccelerationStage stage;
+  int columns[3];
+  bool resolved = false, own = false;
+
+  void find(const SampleBlock& block) {
+    int k = 0;
+    for(const char* name : {"xLinearAcceleration", "yLinearAcceleration", "zLinearAcceleration"}) {
+      columns[k++] = block.find(name);
+    }
+  }
+
+public:
+  // column indices of x, y, z, filled for this block
+  const int* operator()(SampleBlock& block) {
+    if(!resolved) {
+      find(block);
+      own = columns[0] < 0;
+      resolved = true;
+    }
+    if(own) {
+      stage.process(block);
+      find(block);
+    }
+    return columns;
+  }
+};
+
+enum orientationRepresentation { eulerRepresentation, quaternionRepresentation, matrixRepresentation };
+
+// adds the orientation in another representation: roll, pitch, yaw columns in degrees, qw, qx, qy, qz or
+// the matrix elements r00 ... r22; the source are the quaternion columns of a preceding stage if there
+// are any, else matrix columns, else angle
+class OrientationConversionStage : public Stage {
+  orientationRepresentation target, source;
+  std::vector<int> inputs, outputs;
+  RotationColumns rotations;
+  bool resolved = false;
+
+  static std::vector<std::string> names(orientationRepresentation representation) {
+    switch(representation) {
+    case eulerRepresentation:
+      return {"roll", "pitch", "yaw"};
+    case quaternionRepresentation:
+      return {"qw", "qx", "qy", "qz"};
+    default:
+      return {"r00", "r01", "r02", "r10", "r11", "r12", "r20", "r21", "r22"};
+    }
+  }
+
+  void resolve(SampleBlock& block) {
+    source = eulerRepresentation;
+    inputs = {xAngle, yAngle, zAngle};
+    for(auto candidate : {matrixRepresentation, quaternionRepresentation}) {
+      std::vector<int> columns;
+      for(const auto& name : names(candidate)) {
+        columns.push_back(block.find(name));
+      }
+      if(candidate != target && columns[0] >= 0) {
+        source = candidate;
+        inputs = columns;
+      }
+    }
+    for(const auto& name : names(target)) {
+      outputs.push_back(block.column(name));
+    }
+    resolved = true;
+  }
+
+public:
+  OrientationConversionStage(orientationRepresentation target_) : target(target_) {
+  }
+
+  void process(SampleBlock& block) override {
+    if(!resolved) {
+      resolve(block);
+    }
+    size_t n = block.size();
+    auto in = [&](int k) { return block.columns[inputs[k]].data(); };
+    auto out = [&](int k) { return block.columns[outputs[k]].data(); };
+    if(source == matrixRepresentation) {
+      rotations.resize(n);
+      for(int k = 0; k < 9; ++k) {
+        std::copy(in(k), in(k) + n, rotations.m[k].begin());
+      }
+    }
+
+    if(target == matrixRepresentation) {
+      if(source == quaternionRepresentation) {
+        quaternionsToMatrices(in(0), in(1), in(2), in(3), n, rotations);
+      } else {
+        eulerToMatrices(in(0), in(1), in(2), n, rotations);
+      }
+      for(int k = 0; k < 9; ++k) {
+        std::swap(block.columns[outputs[k]], rotations.m[k]);
+      }
+    } else if(target == quaternionRepresentation) {
+      if(source == matrixRepresentation) {
+        matricesToQuaternions(rotations, n, out(0), out(1), out(2), out(3));
+      } else {
+        eulerToQuaternions(in(0), in(1), in(2), n, out(0), out(1), out(2), out(3));
+      }
+    } else {
+      if(source == matrixRepresentation) {
+        matricesToEuler(rotations, n, out(0), out(1), out(2));
+      } else if(source == quaternionRepresentation) {
+        quaternionsToEuler(in(0), in(1), in(2), in(3), n, out(0), out(1), out(2));
+      } else {
+        for(int k = 0; k < 3; ++k) {
+          std::copy(in(k), in(k) + n, out(k));
+        }
+      }
+    }
+
+    for(size_t w = 0; w < block.words(); ++w) {
+      uint64_t valid = ~uint64_t(0);
+      for(int input : inputs) {
+        valid &= block.valid[input][w];
+      }
+      for(int output : outputs) {
+        block.valid[output][w] = valid;
+      }
+    }
+  }
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent workers so stages can go parallel per block without spawning threads every time
+class ThreadPool {
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  const std::function<void(size_t)>* task = nullptr;
+  size_t count = 0, next = 0, running = 0;
+  unsigned generation = 0;
+  bool stopping = false;
+
+  // runs indices of the current task until none are left, called with the lock held
+  void work(std::unique_lock<std::mutex>& lock) {
+    while(next < count) {
+      size_t i = next++;
+      ++running;
+      lock.unlock();
+      (*task)(i);
+      lock.lock();
+      --running;
+    }
+    if(running == 0) {
+      finished.notify_all();
+    }
+  }
+
+  void loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    unsigned seen = generation;
+    while(true) {
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if(stopping) {
+        return;
+      }
+      seen = generation;
+      work(lock);
+    }
+  }
+
+public:
+  ThreadPool(unsigned threads = std::max(std::thread::hardware_concurrency(), 1u)) {
+    // the calling thread is one of them
+    for(unsigned i = 1; i < threads; ++i) {
+      workers.emplace_back(&ThreadPool::loop, this);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  size_t size() const {
+    return workers.size() + 1;
+  }
+
+  // calls f(0) ... f(n - 1) in parallel and returns once all are done, not reentrant
+  void parallelFor(size_t n, const std::function<void(size_t)>& f) {
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &f;
+    count = n;
+    next = 0;
+    ++generation;
+    wake.notify_all();
+    work(lock);
+    finished.wait(lock, [&] { return running == 0; });
+  }
+};
+
+inline ThreadPool& threadPool() {
+  static ThreadPool pool;
+  return pool;
+}
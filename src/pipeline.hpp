@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block.hpp"
+#include "dtw.hpp"
+#include "falls.hpp"
+#include "features.hpp"
+#include "filters.hpp"
+#include "impacts.hpp"
+#include "median.hpp"
+#include "motifs.hpp"
+#include "neighbors.hpp"
+#include "orientation.hpp"
+#include "resample.hpp"
+#include "savgol.hpp"
+#include "segmentation.hpp"
+#include "tempo.hpp"
+#include "trajectory.hpp"
+#include "unwrap.hpp"
+#include "statistics.hpp"
+
+// kernels see NaN for invalid samples, the validity of their result sets the valid bit
+
+// runs a kernel of the expression on every sensor channel, one expression per attribute
+template <class E>
+class ColumnStage : public Stage {
+  using Kernel = decltype(std::declval<E>().template bind<double>());
+  std::vector<Kernel> kernels;
+
+public:
+  ColumnStage(const E& acceleration, const E& angle, const E& rotationVelocity) {
+    for(const E* expression : {&acceleration, &angle, &rotationVelocity}) {
+      for(int i = 0; i < 3; ++i) {
+        kernels.push_back(expression->template bind<double>());
+      }
+    }
+  }
+
+  void process(SampleBlock& block) override {
+    for(int c = 0; c < channelCount; ++c) {
+      auto& kernel = kernels[c];
+      auto& column = block.columns[c];
+      auto& mask = block.valid[c];
+      for(size_t i = 0; i < block.size(); ++i) {
+        column[i] = kernel(isSet(mask, i) ? column[i] : invalid<double>());
+        setBit(mask, i, isValid(column[i]));
+      }
+    }
+  }
+};
+
+// runs a kernel of the expression on the (x, y, z) vectors of every attribute
+template <class E>
+class AttributeStage : public Stage {
+  using Kernel = decltype(std::declval<E>().template bind<Vec3>());
+  std::vector<Kernel> kernels;
+
+public:
+  AttributeStage(const E& acceleration, const E& angle, const E& rotationVelocity) {
+    for(const E* expression : {&acceleration, &angle, &rotationVelocity}) {
+      kernels.push_back(expression->template bind<Vec3>());
+    }
+  }
+
+  void process(SampleBlock& block) override {
+    for(int a = 0; a < 3; ++a) {
+      auto& kernel = kernels[a];
+      auto& x = block.columns[3 * a];
+      auto& y = block.columns[3 * a + 1];
+      auto& z = block.columns[3 * a + 2];
+      Mask* masks[] = {&block.valid[3 * a], &block.valid[3 * a + 1], &block.valid[3 * a + 2]};
+      for(size_t i = 0; i < block.size(); ++i) {
+        Vec3 v = kernel(Vec3{isSet(*masks[0], i) ? x[i] : invalid<double>(),
+                             isSet(*masks[1], i) ? y[i] : invalid<double>(),
+                             isSet(*masks[2], i) ? z[i] : invalid<double>()});
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+        for(auto* mask : masks) {
+          setBit(*mask, i, isValid(v));
+        }
+      }
+    }
+  }
+};
+
+// clears the valid bit of values with a magnitude below the minimum of their attribute
+class SmallValuesStage : public Stage {
+  double minValues[3];
+
+public:
+  SmallValuesStage(double minAcceleration, double minAngle, double minRotationVelocity)
+      : minValues{minAcceleration, minAngle, minRotationVelocity} {
+  }
+
+  void process(SampleBlock& block) override {
+    for(int c = 0; c < channelCount; ++c) {
+      const double* column = block.columns[c].data();
+      double minValue = minValues[c / 3];
+      size_t n = block.size();
+      for(size_t w = 0; w < block.words(); ++w) {
+        uint64_t bits = 0;
+        size_t begin = 64 * w, end = std::min(n, begin + 64);
+        for(size_t i = begin; i < end; ++i) {
+          bits |= uint64_t(std::fabs(column[i]) >= minValue) << (i - begin);
+        }
+        block.valid[c][w] &= bits;
+      }
+    }
+  }
+};
+
+// clears the valid bits of vectors with a squared norm below the minimum of their attribute
+class SmallValuesAbsStage : public Stage {
+  double minValues[3];
+
+public:
+  SmallValuesAbsStage(double minAcceleration, double minAngle, double minRotationVelocity)
+      : minValues{minAcceleration, minAngle, minRotationVelocity} {
+  }
+
+  void process(SampleBlock& block) override {
+    for(int a = 0; a < 3; ++a) {
+      const double* x = block.columns[3 * a].data();
+      const double* y = block.columns[3 * a + 1].data();
+      const double* z = block.columns[3 * a + 2].data();
+      size_t n = block.size();
+      for(size_t w = 0; w < block.words(); ++w) {
+        uint64_t bits = 0;
+        size_t begin = 64 * w, end = std::min(n, begin + 64);
+        for(size_t i = begin; i < end; ++i) {
+          bits |= uint64_t(x[i] * x[i] + y[i] * y[i] + z[i] * z[i] >= minValues[a]) << (i - begin);
+        }
+        for(int c = 3 * a; c < 3 * a + 3; ++c) {
+          block.valid[c][w] &= bits;
+        }
+      }
+    }
+  }
+};
+
+template <class E>
+std::unique_ptr<Stage> columnStage(const Expression<E>& acceleration,
+                                   const Expression<E>& angle,
+                                   const Expression<E>& rotationVelocity) {
+  return std::unique_ptr<Stage>(new ColumnStage<E>(acceleration.self(), angle.self(), rotationVelocity.self()));
+}
+
+template <class E>
+std::unique_ptr<Stage> columnStage(const Expression<E>& expression) {
+  return columnStage(expression, expression, expression);
+}
+
+template <class E>
+std::unique_ptr<Stage> attributeStage(const Expression<E>& acceleration,
+                                      const Expression<E>& angle,
+                                      const Expression<E>& rotationVelocity) {
+  return std::unique_ptr<Stage>(new AttributeStage<E>(acceleration.self(), angle.self(), rotationVelocity.self()));
+}
+
+// parses "20", "20Hz", returns false if nothing numeric is left
+inline bool parseValue(const std::string& text, double& value) {
+  char* end;
+  value = std::strtod(text.c_str(), &end);
+  std::string unit(end);
+  return end != text.c_str() && (unit.empty() || unit == "Hz");
+}
+
+// integral and at least min, for stage arguments that are counts or lengths in samples
+inline bool isCount(double value, double min = 1) {
+  return value >= min && value == std::floor(value);
+}
+
+inline std::vector<std::string> split(const std::string& text, char separator) {
+  std::vector<std::string> parts;
+  size_t begin = 0, end;
+  while((end = text.find(separator, begin)) != std::string::npos) {
+    parts.push_back(text.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  parts.push_back(text.substr(begin));
+  return parts;
+}
+
+// stages of a "--pipeline" spec, all of them are run on one block before the next one is loaded
+class Pipeline {
+  std::vector<std::unique_ptr<Stage>> stages;
+  bool quaternionColumns = false;  // a stage writes qw, qx, qy, qz, a second one would overwrite them
+
+public:
+  double sampleRate;  // of the samples entering the next stage added
+  std::string tablePrefix;  // stages producing tables write them to <tablePrefix>.<table>.tsv (or .bin)
+  std::string recordingName;  // label of the strokes extracted by templates
+  std::vector<std::string> templateFiles;  // tables written by templates, used by classify
+  std::vector<std::string> archiveFiles;  // tables written by features, searched by neighbors
+
+  Pipeline(double sampleRate_ = defaultSampleRate) : sampleRate(sampleRate_) {
+  }
+
+  // "name:arg,arg|name:arg", on failure the offending stage is returned in error
+  bool parse(const std::string& spec, std::string& error) {
+    for(const auto& stageSpec : split(spec, '|')) {
+      if(!addStage(stageSpec)) {
+        error = stageSpec;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool addStage(const std::string& stageSpec) {
+    auto colon = stageSpec.find(':');
+    std::string name = stageSpec.substr(0, colon);
+    std::vector<double> args;
+    if(colon != std::string::npos) {
+      for(const auto& arg : split(stageSpec.substr(colon + 1), ',')) {
+        double value;
+        if(!parseValue(arg, value)) {
+          return false;
+        }
+        args.push_back(value);
+      }
+    }
+
+    bool writesQuaternion = name == "madgwick" || name == "mahony" || name == "quaternion" ||
+                            (name == "unwrap" && args.size() == 1 && args[0] == 1);
+    if(writesQuaternion && quaternionColumns) {
+      return false;
+    }
+    quaternionColumns |= writesQuaternion;
+
+    bool nonNegative = std::all_of(args.begin(), args.end(), [](double arg) { return arg >= 0; });
+    if(name == "small" && args.size() == 3 && nonNegative) {
+      stages.emplace_back(new SmallValuesStage(args[0], args[1], args[2]));
+    } else if(name == "smallabs" && args.size() == 3 && nonNegative) {
+      stages.emplace_back(new SmallValuesAbsStage(args[0], args[1], args[2]));
+    } else if(name == "lowpass" && args.size() == 1 && args[0] > 0 && args[0] < sampleRate / 2) {
+      stages.push_back(columnStage(lowpass(args[0], sampleRate)));
+    } else if(name == "envelope" && args.size() == 1 && isCount(args[0])) {
+      stages.push_back(columnStage(envelope(args[0])));
+    } else if(name == "stats" && args.size() == 1 && isCount(args[0])) {
+      stages.emplace_back(new RollingStatisticsStage(args[0]));
+    } else if(name == "median" && args.size() == 1 && isCount(args[0])) {
+      stages.emplace_back(new ChannelParallelStage<MedianKernel>(MedianKernel(args[0])));
+    } else if(name == "hampel" && (args.size() == 1 || args.size() == 2) && isCount(args[0]) && nonNegative) {
+      stages.emplace_back(new ChannelParallelStage<HampelKernel>(HampelKernel(args[0], args.size() == 2 ? args[1] : 3)));
+    } else if(name == "savgol" && (args.size() == 2 || args.size() == 3) &&
+              std::all_of(args.begin(), args.end(), [](double arg) { return isCount(arg, 0); })) {
+      int derivative = args.size() == 3 ? args[2] : 0;
+      auto taps = savitzkyGolay(args[0], args[1], derivative);
+      if(taps.empty()) {
+        return false;
+      }
+      stages.emplace_back(new SavitzkyGolayStage(taps, derivative, sampleRate));
+    } else if(name == "madgwick" && args.size() <= 1 && nonNegative) {
+      double beta = args.empty() ? 0.1 : args[0];
+      stages.emplace_back(new OrientationStage<MadgwickFilter<1>>(MadgwickFilter<1>(&beta), sampleRate));
+    } else if(name == "mahony" && args.size() <= 2 && nonNegative) {
+      double kp = args.empty() ? 0.5 : args[0], ki = args.size() < 2 ? 0 : args[1];
+      stages.emplace_back(new OrientationStage<MahonyFilter<1>>(MahonyFilter<1>(&kp, &ki), sampleRate));
+    } else if(name == "linear" && args.empty()) {
+      stages.emplace_back(new LinearAccelerationStage());
+    } else if(name == "trajectory" && (args.empty() || (args.size() == 3 && args[0] > 0 && args[1] > 0 && isCount(args[2])))) {
+      stages.emplace_back(new TrajectoryStage(tableFile("trajectories"), sampleRate, args.empty() ? 20 : args[0],
+                                              args.empty() ? 0.001 : args[1], args.empty() ? 10 : args[2]));
+    } else if(name == "strokes" && args.size() >= 2 && args.size() <= 4 && args[1] <= args[0] && nonNegative &&
+              (args.size() < 3 || isCount(args[2])) && (args.size() < 4 || isCount(args[3], 0))) {
+      stages.emplace_back(new StrokeSegmentationStage(tableFile("strokes"), args[0], args[1],
+                                                      args.size() > 2 ? args[2] : 3, args.size() > 3 ? args[3] : 0));
+    } else if(name == "templates" && args.size() == 2 && args[1] <= args[0] && nonNegative) {
+      stages.emplace_back(new TemplateStage(tableFile("templates"), recordingName, args[0], args[1]));
+    } else if(name == "classify" && (args.size() == 2 || args.size() == 3) && args[1] <= args[0] && nonNegative &&
+              (args.size() < 3 || isCount(args[2], 0))) {
+      std::vector<StrokeShape> shapes;
+      for(const auto& file : templateFiles) {
+        if(!readShapes(file, shapes)) {
+          return false;
+        }
+      }
+      if(shapes.empty()) {
+        return false;
+      }
+      DtwClassifier classifier(shapes, args.size() == 3 ? args[2] : shapeLength / 10);
+      stages.emplace_back(new ClassifyStage(tableFile("classes"), classifier, args[0], args[1]));
+    } else if(name == "tempo" && (args.size() == 1 || args.size() == 2) && isCount(args[0], 4) &&
+              (args.size() < 2 || isCount(args[1]))) {
+      size_t hop = args.size() == 2 ? args[1] : args[0] / 4;
+      stages.emplace_back(new TempoStage(tableFile("tempo"), args[0], std::max(hop, (size_t) 1), sampleRate));
+    } else if(name == "falls" && (args.empty() || args.size() == 2 || args.size() == 4) && nonNegative &&
+              (args.size() < 4 || (isCount(args[2]) && isCount(args[3], 0)))) {
+      double freeFall = args.empty() ? 0.3 : args[0], impact = args.empty() ? 3 : args[1];
+      int minFreeFall = args.size() == 4 ? args[2] : std::max(sampleRate / 10, 1.);
+      int maxGap = args.size() == 4 ? args[3] : sampleRate / 2;
+      if(impact <= freeFall) {
+        return false;
+      }
+      stages.emplace_back(new FallStage(tableFile("falls"), freeFall, impact, std::max(minFreeFall, 1), maxGap));
+    } else if(name == "impacts" && (args.size() == 1 || args.size() == 2) && nonNegative &&
+              (args.size() < 2 || isCount(args[1]))) {
+      int minDistance = args.size() == 2 ? args[1] : std::max(sampleRate / 10, 1.);
+      stages.emplace_back(new ImpactStage(tableFile("impacts"), args[0], std::max(minDistance, 1)));
+    } else if(name == "features" && args.size() == 2 && args[1] <= args[0] && nonNegative) {
+      stages.emplace_back(new StrokeFeatureStage(tableFile("features", "bin"), sampleRate, args[0], args[1]));
+    } else if(name == "neighbors" && (args.size() == 2 || args.size() == 3) && args[1] <= args[0] && nonNegative &&
+              (args.size() < 3 || isCount(args[2]))) {
+      std::vector<ArchiveStroke> archive;
+      if(!readArchive(archiveFiles, archive) || archive.empty()) {
+        return false;
+      }
+      stages.emplace_back(new NeighborStage(tableFile("neighbors"), tableFile("index", "bin"), archive, archiveFiles,
+                                            args.size() == 3 ? args[2] : 5, sampleRate, args[0], args[1]));
+    } else if(name == "motifs" && (args.size() == 2 || args.size() == 3) && isCount(args[0], 0) &&
+              args[0] < channelCount && isCount(args[1], 4) &&
+              (args.size() == 2 || (args[2] > 0 && args[2] <= 1))) {
+      stages.emplace_back(new MatrixProfileStage(tableFile("profile"), tableFile("motifs"), args[0], args[1],
+                                                 args.size() == 3 ? args[2] : 1));
+    } else if(name == "unwrap" && (args.empty() || (args.size() == 1 && (args[0] == 0 || args[0] == 1)))) {
+      stages.emplace_back(new UnwrapStage(!args.empty() && args[0] == 1));
+    } else if(name == "euler" && args.empty()) {
+      stages.emplace_back(new OrientationConversionStage(eulerRepresentation));
+    } else if(name == "quaternion" && args.empty()) {
+      stages.emplace_back(new OrientationConversionStage(quaternionRepresentation));
+    } else if(name == "matrix" && args.empty()) {
+      stages.emplace_back(new OrientationConversionStage(matrixRepresentation));
+    } else if(name == "resample" && args.size() == 1 && args[0] > 0) {
+      int up, down;
+      rationalRatio(args[0] / sampleRate, up, down);
+      stages.emplace_back(new ResampleStage(up, down, args[0]));
+      sampleRate = args[0];
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  std::string tableFile(const std::string& table, const std::string& extension = "tsv") const {
+    return tablePrefix + (tablePrefix.empty() ? "" : ".") + table + "." + extension;
+  }
+
+  void process(SampleBlock& block) {
+    for(auto& stage : stages) {
+      stage->process(block);
+    }
+  }
+
+  void finish() {
+    for(auto& stage : stages) {
+      stage->finish();
+    }
+  }
+};
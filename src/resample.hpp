@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+
+// up by L, down by M with L / M the closest ratio with M <= maxDenominator
+inline void rationalRatio(double ratio, int& up, int& down, int maxDenominator = 1000) {
+  double bestError = HUGE_VAL;
+  up = down = 1;
+  for(int m = 1; m <= maxDenominator; ++m) {
+    int l = std::max(1L, std::lround(ratio * m));
+    double error = std::fabs((double) l / m - ratio);
+    if(error < bestError * (1 - 1e-12)) {
+      bestError = error;
+      up = l;
+      down = m;
+    }
+    if(error <= 1e-9 * ratio) {
+      break;
+    }
+  }
+}
+
+// polyphase rational resampler, the anti aliasing filter is a blackman windowed sinc at the lower
+// of the two nyquist frequencies, centered so output k is an estimate at input time k * M / L
+class Resampler {
+  int up, down;
+  int taps;  // per phase
+  std::vector<std::vector<double>> phases;  // phases[p][m] = h[p + m * up]
+  int center;  // of h, in upsampled samples
+
+public:
+  Resampler(int up_, int down_, int halfLength = 8) : up(up_), down(down_) {
+    int factor = std::max(up, down);
+    int length = 2 * halfLength * factor + 1;
+    center = halfLength * factor;
+    taps = (length + up - 1) / up;
+    phases.assign(up, std::vector<double>(taps, 0));
+    double cutoff = 0.5 / factor;  // in cycles per upsampled sample
+    for(int j = 0; j < length; ++j) {
+      double x = j - center;
+      double sinc = x == 0 ? 2 * cutoff : std::sin(2 * M_PI * cutoff * x) / (M_PI * x);
+      double window = 0.42 - 0.5 * std::cos(2 * M_PI * j / (length - 1)) + 0.08 * std::cos(4 * M_PI * j / (length - 1));
+      phases[j % up][j / up] = up * sinc * window;
+    }
+  }
+
+  int tapCount() const {
+    return taps;
+  }
+
+  // newest input sample output k depends on, outputs are ready once it was read
+  long newestInput(long k) const {
+    return (k * down + center) / up;
+  }
+
+  // output k from the input x, x(i) must be valid for newestInput(k) - taps < i <= newestInput(k)
+  template <class Input>
+  double output(long k, Input x) const {
+    long u = k * down + center;
+    long newest = u / up;
+    const auto& h = phases[u % up];
+    double y = 0;
+    for(int m = 0; m < taps; ++m) {
+      y += h[m] * x(newest - m);
+    }
+    return y;
+  }
+};
+
+// resamples every column of the stream to a new rate, t becomes the output sample index and a
+// time column in seconds gives the uniform grid; invalid samples hold the previous valid value
+// and outputs are valid if their inputs were mostly valid; outputs that would need samples past the
+// end of the stream are not produced
+class ResampleStage : public Stage {
+  Resampler resampler;
+  double outputRate;
+  long nextOutput = 0;
+  long firstInput = 0;  // input index of history[.][0]
+  size_t columnCount = 0;  // columns of the first block, the ones that are resampled
+  std::vector<std::vector<double>> history, historyValid;
+  std::vector<double> lastValid;
+  std::vector<bool> started;
+  int timeColumn = -1;
+
+  SampleBlock output;
+
+public:
+  ResampleStage(int up, int down, double outputRate_) : resampler(up, down), outputRate(outputRate_) {
+  }
+
+  void process(SampleBlock& block) override {
+    // columns later stages append come back in the blocks passed in, they are not resampled but
+    // recomputed by those stages, so every history stays aligned with firstInput
+    if(timeColumn < 0) {
+      timeColumn = block.column("time");
+      columnCount = block.columns.size();
+      history.resize(columnCount);
+      historyValid.resize(columnCount);
+      lastValid.resize(columnCount, 0);
+      started.resize(columnCount, false);
+    }
+
+    for(size_t c = 0; c < columnCount; ++c) {
+      for(size_t i = 0; i < block.size(); ++i) {
+        bool valid = isSet(block.valid[c], i);
+        if(valid) {
+          lastValid[c] = block.columns[c][i];
+          // before the first valid sample the history is back filled with it
+          if(!started[c]) {
+            std::fill(history[c].begin(), history[c].end(), lastValid[c]);
+            started[c] = true;
+          }
+        }
+        history[c].push_back(lastValid[c]);
+        historyValid[c].push_back(valid);
+      }
+    }
+    long lastInput = firstInput + (long) history[0].size() - 1;
+
+    output.names = block.names;
+    output.columns.resize(block.columns.size());
+    output.valid.resize(block.columns.size());
+    output.resize(0);
+    for(; resampler.newestInput(nextOutput) <= lastInput; ++nextOutput) {
+      size_t i = output.size();
+      output.resize(i + 1);
+      output.t[i] = nextOutput;
+      for(size_t c = 0; c < columnCount; ++c) {
+        // samples before the start of the stream repeat the first one
+        auto value = [&](long index) { return history[c][std::max(index - firstInput, 0L)]; };
+        auto validity = [&](long index) { return historyValid[c][std::max(index - firstInput, 0L)]; };
+        output.columns[c][i] = resampler.output(nextOutput, value);
+        setBit(output.valid[c], i, resampler.output(nextOutput, validity) > 0.5);
+      }
+      output.columns[timeColumn][i] = nextOutput / outputRate;
+      setBit(output.valid[timeColumn], i, true);
+    }
+
+    // keep what the next output still needs
+    long keepFrom = std::min(resampler.newestInput(nextOutput) - resampler.tapCount() + 1, lastInput + 1);
+    if(keepFrom > firstInput) {
+      for(size_t c = 0; c < columnCount; ++c) {
+        history[c].erase(history[c].begin(), history[c].begin() + (keepFrom - firstInput));
+        historyValid[c].erase(historyValid[c].begin(), historyValid[c].begin() + (keepFrom - firstInput));
+      }
+      firstInput = keepFrom;
+    }
+
+    std::swap(block, output);
+  }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block.hpp"
+
+// savitzky golay filters: least squares polynomial fit over a centered window, evaluated (or
+// differentiated) at the center; the taps are computed at compile time for every instantiated
+// half width / order / derivative, the runtime spec picks from the instantiated set
+
+template <int length>
+struct Taps {
+  double c[length];
+};
+
+// taps of the derivative-th derivative (per sample) of a polynomial of the given order fitted to
+// samples -halfWidth ... halfWidth, tap j weights sample j - halfWidth
+template <int length>
+constexpr Taps<length> savitzkyGolayTaps(int halfWidth, int order, int derivative) {
+  constexpr int maxTerms = 8;
+  int terms = order + 1;
+
+  // normal equations A w = v with A[r][s] = sum_j j^(r + s), v = e_derivative * derivative!
+  double a[maxTerms][maxTerms + 1] = {};
+  for(int r = 0; r < terms; ++r) {
+    for(int s = 0; s < terms; ++s) {
+      for(int j = -halfWidth; j <= halfWidth; ++j) {
+        double power = 1;
+        for(int k = 0; k < r + s; ++k) {
+          power *= j;
+        }
+        a[r][s] += power;
+      }
+    }
+    double factorial = 1;
+    for(int k = 2; k <= derivative; ++k) {
+      factorial *= k;
+    }
+    a[r][terms] = r == derivative ? factorial : 0;
+  }
+
+  // gauss jordan with partial pivoting
+  for(int col = 0; col < terms; ++col) {
+    int pivot = col;
+    for(int r = col + 1; r < terms; ++r) {
+      if((a[r][col] < 0 ? -a[r][col] : a[r][col]) > (a[pivot][col] < 0 ? -a[pivot][col] : a[pivot][col])) {
+        pivot = r;
+      }
+    }
+    for(int s = 0; s <= terms; ++s) {
+      double swap = a[col][s];
+      a[col][s] = a[pivot][s];
+      a[pivot][s] = swap;
+    }
+    for(int r = 0; r < terms; ++r) {
+      if(r != col) {
+        double factor = a[r][col] / a[col][col];
+        for(int s = col; s <= terms; ++s) {
+          a[r][s] -= factor * a[col][s];
+        }
+      }
+    }
+  }
+
+  // tap j = sum_k w_k j^k
+  Taps<length> taps = {};
+  for(int j = -halfWidth; j <= halfWidth; ++j) {
+    double power = 1;
+    for(int k = 0; k < terms; ++k) {
+      taps.c[j + halfWidth] += a[k][terms] / a[k][k] * power;
+      power *= j;
+    }
+  }
+  return taps;
+}
+
+template <int halfWidth, int order, int derivative>
+struct SavitzkyGolay {
+  static_assert(order < 2 * halfWidth + 1 && order < 8 && derivative <= order, "fit not determined");
+  static constexpr int length = 2 * halfWidth + 1;
+  static constexpr Taps<length> taps = savitzkyGolayTaps<length>(halfWidth, order, derivative);
+};
+
+template <int halfWidth, int order, int derivative>
+constexpr Taps<SavitzkyGolay<halfWidth, order, derivative>::length> SavitzkyGolay<halfWidth, order, derivative>::taps;
+
+// instantiated half widths minHalfWidth ... maxHalfWidth, orders 2 ... 4, derivatives 0 ... 2
+constexpr int minHalfWidth = 2;
+constexpr int maxHalfWidth = 12;
+constexpr int minOrder = 2;
+constexpr int maxOrder = 4;
+constexpr int maxDerivative = 2;
+
+template <int halfWidth, int order, int derivative>
+std::vector<double> tapsOf() {
+  const auto& taps = SavitzkyGolay<halfWidth, order, derivative>::taps.c;
+  return std::vector<double>(taps, taps + 2 * halfWidth + 1);
+}
+
+template <int halfWidth, int order, int... derivatives>
+void addDerivatives(std::vector<std::vector<double>>& table, std::integer_sequence<int, derivatives...>) {
+  int unused[] = {(table.push_back(tapsOf<halfWidth, order, derivatives>()), 0)...};
+  (void) unused;
+}
+
+template <int halfWidth, int... orders>
+void addOrders(std::vector<std::vector<double>>& table, std::integer_sequence<int, orders...>) {
+  int unused[] = {
+      (addDerivatives<halfWidth, minOrder + orders>(table, std::make_integer_sequence<int, maxDerivative + 1>()), 0)...};
+  (void) unused;
+}
+
+template <int... halfWidths>
+std::vector<std::vector<double>> tapsTable(std::integer_sequence<int, halfWidths...>) {
+  std::vector<std::vector<double>> table;
+  int unused[] = {
+      (addOrders<minHalfWidth + halfWidths>(table, std::make_integer_sequence<int, maxOrder - minOrder + 1>()), 0)...};
+  (void) unused;
+  return table;
+}
+
+// taps of an instantiated configuration, empty if the window is not one of them; window = 2 * halfWidth + 1
+inline std::vector<double> savitzkyGolay(int window, int order, int derivative) {
+  static const auto table = tapsTable(std::make_integer_sequence<int, maxHalfWidth - minHalfWidth + 1>());
+  int halfWidth = window / 2;
+  if(window % 2 == 0 || halfWidth < minHalfWidth || halfWidth > maxHalfWidth || order < minOrder ||
+     order > maxOrder || derivative < 0 || derivative > std::min(maxDerivative, order)) {
+    return {};
+  }
+  int orders = maxOrder - minOrder + 1;
+  return table[((halfWidth - minHalfWidth) * orders + order - minOrder) * (maxDerivative + 1) + derivative];
+}
+
+// convolution of every sensor channel with the taps, result lags the input by half the window;
+// invalid samples hold the previous valid value and the history is back filled with the first one,
+// outputs are valid if the center sample was
+class SavitzkyGolayStage : public Stage {
+  std::vector<double> taps;
+  double scale;  // per sample to per second derivatives
+  std::string suffix;  // empty smooths in place, else appends <channel><suffix> columns
+  std::vector<double> history[channelCount];  // last taps.size() - 1 samples
+  std::vector<bool> historyValid[channelCount];
+  double lastValid[channelCount] = {0};
+  bool started[channelCount] = {false};
+  int outputs[channelCount];
+  bool resolved = false;
+  std::vector<double> buffer;
+
+public:
+  SavitzkyGolayStage(std::vector<double> taps_, int derivative, double sampleRate)
+      : taps(std::move(taps_)), scale(std::pow(sampleRate, derivative)) {
+    suffix = derivative == 0 ? "" : derivative == 1 ? "Derivative" : "SecondDerivative";
+    for(int c = 0; c < channelCount; ++c) {
+      history[c].assign(taps.size() - 1, 0);
+      historyValid[c].assign(taps.size() - 1, false);
+    }
+  }
+
+  void process(SampleBlock& block) override {
+    if(!resolved) {
+      for(int c = 0; c < channelCount; ++c) {
+        outputs[c] = suffix.empty() ? c : block.column(block.names[c] + suffix);
+      }
+      resolved = true;
+    }
+
+    size_t n = block.size(), length = taps.size();
+    for(int c = 0; c < channelCount; ++c) {
+      // history followed by the block
+      buffer = history[c];
+      auto& valid = historyValid[c];
+      for(size_t i = 0; i < n; ++i) {
+        bool isValid = isSet(block.valid[c], i);
+        lastValid[c] = isValid ? block.columns[c][i] : lastValid[c];
+        // before the first valid sample the history is back filled with it
+        if(isValid && !started[c]) {
+          std::fill(buffer.begin(), buffer.end(), lastValid[c]);
+          started[c] = true;
+        }
+        buffer.push_back(lastValid[c]);
+        valid.push_back(isValid);
+      }
+
+      auto& out = block.columns[outputs[c]];
+      const double* x = buffer.data();
+      const double* h = taps.data();
+      for(size_t i = 0; i < n; ++i) {
+        double y = 0;
+        for(size_t j = 0; j < length; ++j) {
+          y += h[j] * x[i + j];
+        }
+        out[i] = scale * y;
+      }
+      for(size_t i = 0; i < n; ++i) {
+        setBit(block.valid[outputs[c]], i, valid[i + length / 2]);
+      }
+
+      history[c].assign(buffer.end() - (length - 1), buffer.end());
+      valid.erase(valid.begin(), valid.end() - (length - 1));
+    }
+  }
+};
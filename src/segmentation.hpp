@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#include "block.hpp"
+#include "filters.hpp"
+
+struct Stroke {
+  int start, peak, end;  // t
+  double peakValue;
+};
+
+// online stroke detection with hysteresis: a stroke starts when the signal rises above the start
+// threshold and ends when it falls below the (lower) end threshold, strokes shorter than minLength
+// samples are dropped; invalid samples keep the current state
+class StrokeDetector {
+  double startThreshold, endThreshold;
+  int minLength;
+  bool inStroke = false;
+  int length = 0;
+  Stroke current;
+
+public:
+  StrokeDetector(double startThreshold_, double endThreshold_, int minLength_)
+      : startThreshold(startThreshold_), endThreshold(endThreshold_), minLength(minLength_) {
+  }
+
+  bool isInStroke() const {
+    return inStroke;
+  }
+
+  // returns true once a stroke completed, it is stored in stroke
+  bool push(int t, double value, bool valid, Stroke& stroke) {
+    if(!valid) {
+      return false;
+    }
+    if(!inStroke) {
+      if(value > startThreshold) {
+        inStroke = true;
+        length = 1;
+        current = {t, t, t, value};
+      }
+      return false;
+    }
+    ++length;
+    current.end = t;
+    if(value > current.peakValue) {
+      current.peak = t;
+      current.peakValue = value;
+    }
+    if(value < endThreshold) {
+      inStroke = false;
+      stroke = current;
+      return length >= minLength;
+    }
+    return false;
+  }
+
+  // completes a stroke open at the end of the stream
+  bool finish(Stroke& stroke) {
+    bool open = inStroke && length >= minLength;
+    inStroke = false;
+    stroke = current;
+    return open;
+  }
+};
+
+// segments the stream into strokes on the rotation velocity magnitude (deg/s), optionally on its peak
+// envelope over envelopeWindow samples, and writes one start / peak / end row per stroke to the table
+class StrokeSegmentationStage : public Stage {
+  StrokeDetector detector;
+  bool useEnvelope;
+  EnvelopeKernel envelope;
+  std::ofstream table;
+  int strokes = 0;
+
+  void write(const Stroke& stroke) {
+    table << strokes++ << "\t" << stroke.start << "\t" << stroke.peak << "\t" << stroke.end << "\t" << stroke.peakValue
+          << "\n";
+  }
+
+public:
+  StrokeSegmentationStage(const std::string& tableFile, double startThreshold, double endThreshold, int minLength,
+                          size_t envelopeWindow)
+      : detector(startThreshold, endThreshold, minLength),
+        useEnvelope(envelopeWindow > 0),
+        envelope(std::max(envelopeWindow, (size_t) 1)),
+        table(tableFile) {
+    table << "#stroke,start,peak,end,peakRotationVelocity" << std::endl;
+  }
+
+  void process(SampleBlock& block) override {
+    for(size_t i = 0; i < block.size(); ++i) {
+      bool valid = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      double magnitude =
+          std::sqrt(squaredNorm(Vec3{block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]}));
+      if(useEnvelope) {
+        magnitude = envelope(valid ? magnitude : invalid<double>());
+        valid = isValid(magnitude);
+      }
+      Stroke stroke;
+      if(detector.push(block.t[i], magnitude, valid, stroke)) {
+        write(stroke);
+      }
+    }
+  }
+
+  void finish() override {
+    Stroke stroke;
+    if(detector.finish(stroke)) {
+      write(stroke);
+    }
+    table.flush();
+  }
+};
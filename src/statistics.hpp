@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block.hpp"
+
+// mean, variance, min and max over the last window samples of several lanes (channels) at once,
+// O(1) amortized per sample, invalid samples take a slot in the window but don't contribute
+template <int lanes>
+class RollingStatistics {
+  size_t window;
+  size_t pushed = 0;
+  std::vector<double> ring;  // window * lanes, sample major
+  std::vector<double> ringValid;
+  double n[lanes] = {0}, meanValue[lanes] = {0}, m2[lanes] = {0};
+  std::deque<std::pair<size_t, double>> minima[lanes], maxima[lanes];  // monotonic
+
+  // exact two pass recomputation, bounds the drift of the running updates
+  void recompute() {
+    for(int l = 0; l < lanes; ++l) {
+      double count = 0, sum = 0, squares = 0;
+      for(size_t s = 0; s < window; ++s) {
+        count += ringValid[s * lanes + l];
+        sum += ringValid[s * lanes + l] * ring[s * lanes + l];
+      }
+      double mean = count > 0 ? sum / count : 0;
+      for(size_t s = 0; s < window; ++s) {
+        double delta = ring[s * lanes + l] - mean;
+        squares += ringValid[s * lanes + l] * delta * delta;
+      }
+      n[l] = count;
+      meanValue[l] = mean;
+      m2[l] = squares;
+    }
+  }
+
+public:
+  RollingStatistics(size_t window_) : window(window_), ring(window_ * lanes), ringValid(window_ * lanes) {
+  }
+
+  // one sample of every lane
+  void push(const double* x, const bool* valid) {
+    size_t slot = pushed % window;
+    double* stored = &ring[slot * lanes];
+    double* storedValid = &ringValid[slot * lanes];
+
+    // weights and values as plain doubles first, so the welford loop below only touches double arrays
+    double wIn[lanes], v[lanes];
+    for(int l = 0; l < lanes; ++l) {
+      wIn[l] = valid[l];
+      v[l] = valid[l] ? x[l] : 0;
+    }
+
+    // welford update with weights 0 or 1
+    for(int l = 0; l < lanes; ++l) {
+      // remove the sample leaving the window
+      double wOut = storedValid[l];
+      double y = stored[l];
+      double nOut = n[l] - wOut;
+      double delta = y - meanValue[l];
+      double newMean = meanValue[l] - wOut * delta / (nOut > 1 ? nOut : 1);
+      double m2Out = m2[l] - wOut * delta * (y - newMean);
+      double meanOut = nOut > 0 ? newMean : 0;
+      m2Out = nOut > 0 ? m2Out : 0;
+
+      // add the new one
+      double nIn = nOut + wIn[l];
+      delta = v[l] - meanOut;
+      double meanIn = meanOut + wIn[l] * delta / (nIn > 1 ? nIn : 1);
+      m2[l] = m2Out + wIn[l] * delta * (v[l] - meanIn);
+      meanValue[l] = meanIn;
+      n[l] = nIn;
+
+      stored[l] = v[l];
+      storedValid[l] = wIn[l];
+    }
+
+    for(int l = 0; l < lanes; ++l) {
+      if(valid[l]) {
+        while(!minima[l].empty() && minima[l].back().second >= x[l]) {
+          minima[l].pop_back();
+        }
+        minima[l].emplace_back(pushed, x[l]);
+        while(!maxima[l].empty() && maxima[l].back().second <= x[l]) {
+          maxima[l].pop_back();
+        }
+        maxima[l].emplace_back(pushed, x[l]);
+      }
+      for(auto* extrema : {&minima[l], &maxima[l]}) {
+        while(!extrema->empty() && extrema->front().first + window <= pushed) {
+          extrema->pop_front();
+        }
+      }
+    }
+
+    ++pushed;
+    if(pushed % window == 0) {
+      recompute();
+    }
+  }
+
+  size_t count(int lane) const {
+    return n[lane];
+  }
+
+  double mean(int lane) const {
+    return n[lane] > 0 ? meanValue[lane] : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  // population variance of the window
+  double variance(int lane) const {
+    return n[lane] > 0 ? std::max(m2[lane] / n[lane], 0.) : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  double min(int lane) const {
+    return minima[lane].empty() ? std::numeric_limits<double>::quiet_NaN() : minima[lane].front().second;
+  }
+
+  double max(int lane) const {
+    return maxima[lane].empty() ? std::numeric_limits<double>::quiet_NaN() : maxima[lane].front().second;
+  }
+};
+
+struct ColumnStatistics {
+  std::vector<double> mean, variance, min, max;
+};
+
+// batch mode: statistics of the window ending at every sample of a column, NaN marks invalid samples
+inline ColumnStatistics rollingStatistics(const std::vector<double>& column, size_t window) {
+  RollingStatistics<1> statistics(window);
+  ColumnStatistics result;
+  for(double x : column) {
+    bool valid = !std::isnan(x);
+    statistics.push(&x, &valid);
+    result.mean.push_back(statistics.mean(0));
+    result.variance.push_back(statistics.variance(0));
+    result.min.push_back(statistics.min(0));
+    result.max.push_back(statistics.max(0));
+  }
+  return result;
+}
+
+// streaming mode: appends <channel>Mean, <channel>Variance, <channel>Min and <channel>Max columns
+class RollingStatisticsStage : public Stage {
+  RollingStatistics<channelCount> statistics;
+  static constexpr int statisticCount = 4;
+  int outputs[channelCount][statisticCount];
+  bool resolved = false;
+
+public:
+  RollingStatisticsStage(size_t window) : statistics(window) {
+  }
+
+  void process(SampleBlock& block) override {
+    if(!resolved) {
+      for(int c = 0; c < channelCount; ++c) {
+        std::string name = block.names[c];
+        int s = 0;
+        for(const char* statistic : {"Mean", "Variance", "Min", "Max"}) {
+          outputs[c][s++] = block.column(name + statistic);
+        }
+      }
+      resolved = true;
+    }
+
+    double x[channelCount];
+    bool valid[channelCount];
+    for(size_t i = 0; i < block.size(); ++i) {
+      for(int c = 0; c < channelCount; ++c) {
+        x[c] = block.columns[c][i];
+        valid[c] = isSet(block.valid[c], i);
+      }
+      statistics.push(x, valid);
+      for(int c = 0; c < channelCount; ++c) {
+        double values[statisticCount] = {
+            statistics.mean(c), statistics.variance(c), statistics.min(c), statistics.max(c)};
+        for(int s = 0; s < statisticCount; ++s) {
+          block.columns[outputs[c][s]][i] = values[s];
+          setBit(block.valid[outputs[c][s]], i, statistics.count(c) > 0);
+        }
+      }
+    }
+  }
+};
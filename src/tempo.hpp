@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "filters.hpp"
+
+// in place iterative radix 2 fft, size must be a power of two, inverse is unscaled
+inline void fft(std::vector<std::complex<double>>& a, bool inverse = false) {
+  size_t n = a.size();
+  for(size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for(; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if(i < j) {
+      std::swap(a[i], a[j]);
+    }
+  }
+  for(size_t length = 2; length <= n; length <<= 1) {
+    double angle = 2 * M_PI / length * (inverse ? 1 : -1);
+    std::complex<double> root(std::cos(angle), std::sin(angle));
+    for(size_t i = 0; i < n; i += length) {
+      std::complex<double> w(1);
+      for(size_t j = 0; j < length / 2; ++j) {
+        std::complex<double> u = a[i + j], v = a[i + j + length / 2] * w;
+        a[i + j] = u + v;
+        a[i + j + length / 2] = u - v;
+        w *= root;
+      }
+    }
+  }
+}
+
+// linear (not circular) autocorrelation of x for lags 0 ... x.size() - 1 in O(n log n), normalized to 1 at lag 0
+inline std::vector<double> autocorrelation(const std::vector<double>& x) {
+  size_t n = x.size(), size = 1;
+  while(size < 2 * n) {
+    size <<= 1;
+  }
+  std::vector<std::complex<double>> spectrum(size);
+  std::copy(x.begin(), x.end(), spectrum.begin());
+  fft(spectrum);
+  for(auto& value : spectrum) {
+    value = std::norm(value);
+  }
+  fft(spectrum, true);
+  std::vector<double> result(n);
+  for(size_t lag = 0; lag < n; ++lag) {
+    result[lag] = spectrum[0].real() > 0 ? spectrum[lag].real() / spectrum[0].real() : 0;
+  }
+  return result;
+}
+
+// stroke rate of a window: the highest autocorrelation peak with a period between the given stroke
+// rates, refined by parabolic interpolation; confidence is the autocorrelation at that lag
+inline double strokesPerMinute(const std::vector<double>& window, double sampleRate, double minRate, double maxRate,
+                               double& confidence) {
+  double mean = 0;
+  for(double x : window) {
+    mean += x / window.size();
+  }
+  std::vector<double> centered(window.size());
+  for(size_t i = 0; i < window.size(); ++i) {
+    centered[i] = window[i] - mean;
+  }
+  auto r = autocorrelation(centered);
+
+  size_t minLag = std::max(1., std::floor(60 * sampleRate / maxRate));
+  size_t maxLag = std::min(r.size() - 2, (size_t) std::ceil(60 * sampleRate / minRate));
+  size_t best = 0;
+  for(size_t lag = minLag; lag <= maxLag; ++lag) {
+    bool peak = r[lag] >= r[lag - 1] && r[lag] >= r[lag + 1];
+    if(peak && (best == 0 || r[lag] > r[best])) {
+      best = lag;
+    }
+  }
+  if(best == 0) {
+    confidence = 0;
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  double curvature = r[best - 1] - 2 * r[best] + r[best + 1];
+  double offset = curvature < 0 ? 0.5 * (r[best - 1] - r[best + 1]) / curvature : 0;
+  confidence = r[best];
+  return 60 * sampleRate / (best + offset);
+}
+
+// stroke rate of the rotation velocity magnitude over sliding windows, one row every hop samples
+class TempoStage : public Stage {
+  size_t window, hop;
+  double sampleRate, minRate, maxRate;
+  std::deque<double> magnitudes;
+  double lastValid = 0;
+  size_t sinceLast = 0;
+  std::ofstream table;
+  std::vector<double> buffer;
+
+public:
+  TempoStage(const std::string& tableFile, size_t window_, size_t hop_, double sampleRate_, double minRate_ = 20,
+             double maxRate_ = 300)
+      : window(window_), hop(hop_), sampleRate(sampleRate_), minRate(minRate_), maxRate(maxRate_), table(tableFile) {
+    table << "#t,strokesPerMinute,confidence" << std::endl;
+  }
+
+  void process(SampleBlock& block) override {
+    for(size_t i = 0; i < block.size(); ++i) {
+      if(isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i)) {
+        lastValid = std::sqrt(squaredNorm(Vec3{block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]}));
+      }
+      magnitudes.push_back(lastValid);
+      if(magnitudes.size() > window) {
+        magnitudes.pop_front();
+      }
+      if(magnitudes.size() == window && ++sinceLast >= hop) {
+        sinceLast = 0;
+        buffer.assign(magnitudes.begin(), magnitudes.end());
+        double confidence;
+        double rate = strokesPerMinute(buffer, sampleRate, minRate, maxRate, confidence);
+        table << block.t[i] << "\t" << rate << "\t" << confidence << "\n";
+      }
+    }
+  }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "block.hpp"
+
+// minimal checks for the test programs, every failed one is reported and main returns failures()
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+
+#define CHECK(condition)                                                                   \
+  do {                                                                                     \
+    if(!(condition)) {                                                                     \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+      ++failures();                                                                        \
+    }                                                                                      \
+  } while(false)
+
+#define CHECK_NEAR(a, b, tolerance)                                                                      \
+  do {                                                                                                   \
+    double checkA = (a), checkB = (b);                                                                   \
+    if(!(std::fabs(checkA - checkB) <= (tolerance))) {                                                   \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #a " = " << checkA << ", expected " << checkB << std::endl; \
+      ++failures();                                                                                      \
+    }                                                                                                    \
+  } while(false)
+
+// loads n samples starting at t into the sensor channels like the decoder does, the block is reused
+// so columns appended by stages stay; value(t, channel) gives the samples, all of them valid
+template <typename F>
+void loadSamples(SampleBlock& block, int t, size_t n, F value) {
+  block.resize(n);
+  for(size_t i = 0; i < n; ++i) {
+    block.t[i] = t + i;
+    for(int c = 0; c < channelCount; ++c) {
+      block.columns[c][i] = value(t + (int) i, c);
+      setBit(block.valid[c], i, true);
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#include <fstream>
+#include <random>
+
+#include "check.hpp"
+#include "pipeline.hpp"
+
+// banded dtw without lower bounds or abandoning
+double exactDtw(const StrokeShape& a, const StrokeShape& b, int band) {
+  constexpr double infinity = std::numeric_limits<double>::infinity();
+  std::vector<std::vector<double>> cost(shapeLength + 1, std::vector<double>(shapeLength + 1, infinity));
+  cost[0][0] = 0;
+  for(int i = 0; i < shapeLength; ++i) {
+    for(int j = std::max(0, i - band); j <= std::min(shapeLength - 1, i + band); ++j) {
+      double local = 0;
+      for(int c = 0; c < shapeChannels; ++c) {
+        local += (a.v[c][i] - b.v[c][j]) * (a.v[c][i] - b.v[c][j]);
+      }
+      cost[i + 1][j + 1] = local + std::min({cost[i][j], cost[i][j + 1], cost[i + 1][j]});
+    }
+  }
+  return cost[shapeLength][shapeLength];
+}
+
+StrokeShape randomShape(std::mt19937& random, const std::string& label) {
+  std::normal_distribution<double> normal;
+  std::vector<Vec3> samples;
+  Vec3 v = {0, 0, 0};
+  for(int i = 0; i < 80; ++i) {
+    v = v + Vec3{normal(random), normal(random), normal(random)};
+    samples.push_back(v);
+  }
+  return makeShape(samples, label);
+}
+
+int main() {
+  // pruning by LB_Kim and LB_Keogh must not change the nearest template
+  std::mt19937 random(7);
+  std::vector<StrokeShape> shapes;
+  for(int k = 0; k < 40; ++k) {
+    shapes.push_back(randomShape(random, std::to_string(k)));
+  }
+  for(int band : {0, 3, 6, shapeLength}) {
+    DtwClassifier classifier(shapes, band);
+    for(int q = 0; q < 20; ++q) {
+      StrokeShape query = randomShape(random, "");
+      double best = std::numeric_limits<double>::infinity();
+      for(const auto& shape : shapes) {
+        best = std::min(best, exactDtw(query, shape, band));
+      }
+      double distance;
+      const StrokeShape* nearest = classifier.classify(query, distance);
+      CHECK(nearest != nullptr);
+      CHECK_NEAR(distance, best, 1e-9 * best);
+      CHECK_NEAR(exactDtw(query, *nearest, band), best, 1e-9 * best);
+    }
+  }
+
+  // a negative band ran max_element over an inverted range
+  {
+    std::ofstream templates("dtw.templates.tsv");
+    writeShape(templates, shapes[0]);
+  }
+  Pipeline pipeline(100);
+  pipeline.tablePrefix = "dtw";
+  pipeline.templateFiles = {"dtw.templates.tsv"};
+  std::string error;
+  CHECK(pipeline.parse("classify:100,50,6", error));
+  CHECK(!pipeline.parse("classify:100,50,-1", error));
+  CHECK(!pipeline.parse("classify:100,50,2.5", error));
+  return failures();
+}
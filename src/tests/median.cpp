@@ -0,0 +1,32 @@
+#include "check.hpp"
+#include "median.hpp"
+
+int main() {
+  // alternating 0 and 1 with one spike: only the spike is replaced, by the median of its window
+  std::vector<std::vector<double>> columns(1);
+  for(int i = 0; i < 40; ++i) {
+    columns[0].push_back(i == 20 ? 100 : i % 2);
+  }
+  columns[0][30] = std::nan("");
+  filterColumns(columns, HampelKernel(5, 3));
+  for(int i = 0; i < 40; ++i) {
+    if(i == 20) {
+      CHECK_NEAR(columns[0][i], 1, 0);
+    } else if(i == 30) {
+      CHECK(std::isnan(columns[0][i]));
+    } else {
+      CHECK_NEAR(columns[0][i], i % 2, 0);
+    }
+  }
+
+  // the median lags by (window - 1) / 2 samples
+  columns[0].clear();
+  for(int i = 0; i < 20; ++i) {
+    columns[0].push_back(i);
+  }
+  filterColumns(columns, MedianKernel(5));
+  for(int i = 4; i < 20; ++i) {
+    CHECK_NEAR(columns[0][i], i - 2, 0);
+  }
+  return failures();
+}
@@ -0,0 +1,52 @@
+#include "check.hpp"
+#include "pipeline.hpp"
+
+int main() {
+  // at rest the fused orientation converges from level to the roll and pitch of gravity
+  double roll = 30 * degree, pitch = -20 * degree;
+  auto resting = [&](int t, int c) {
+    if(t == 0) {
+      return c == zAcc ? 1. : 0.;
+    }
+    double gravity[] = {-std::sin(pitch), std::sin(roll) * std::cos(pitch), std::cos(roll) * std::cos(pitch)};
+    return c >= xAcc && c <= zAcc ? gravity[c - xAcc] : 0.;
+  };
+  for(const char* spec : {"madgwick", "mahony"}) {
+    Pipeline pipeline(100);
+    std::string error;
+    CHECK(pipeline.parse(spec, error));
+    SampleBlock block;
+    for(int begin = 0; begin < 10 * blockLength; begin += blockLength) {
+      loadSamples(block, begin, blockLength, resting);
+      pipeline.process(block);
+    }
+    int qw = block.find("qw");
+    CHECK(qw >= 0);
+    if(qw >= 0) {
+      size_t last = block.size() - 1;
+      double w = block.columns[qw][last], x = block.columns[qw + 1][last];
+      double y = block.columns[qw + 2][last], z = block.columns[qw + 3][last];
+      double fusedRoll, fusedPitch, fusedYaw;
+      quaternionsToEuler(&w, &x, &y, &z, 1, &fusedRoll, &fusedPitch, &fusedYaw);
+      CHECK_NEAR(fusedRoll, 30, 0.5);
+      CHECK_NEAR(fusedPitch, -20, 0.5);
+    }
+  }
+
+  // quaternions survive the round trip through matrices, half turns (w = 0) and turns close to them
+  // included, up to the sign that is free when w = 0
+  std::vector<Quaternion> quaternions = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0.6, -0.8, 0}, {0, 0, 0.8, -0.6},
+                                         {1e-3, 0, 0, 1}, {0.5, 0.5, -0.5, 0.5}, {0.9, -0.1, 0.3, 0.2}};
+  for(auto& q : quaternions) {
+    double norm = std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    q = {q.w / norm, q.x / norm, q.y / norm, q.z / norm};
+    RotationColumns rotation;
+    quaternionsToMatrices(&q.w, &q.x, &q.y, &q.z, 1, rotation);
+    Quaternion back;
+    matricesToQuaternions(rotation, 1, &back.w, &back.x, &back.y, &back.z);
+    double dot = q.w * back.w + q.x * back.x + q.y * back.y + q.z * back.z;
+    CHECK_NEAR(std::fabs(dot), 1, 1e-12);
+    CHECK(back.w >= 0);
+  }
+  return failures();
+}
@@ -0,0 +1,25 @@
+#include "check.hpp"
+#include "pipeline.hpp"
+
+bool parses(const std::string& spec) {
+  Pipeline pipeline(100);
+  pipeline.tablePrefix = "pipeline";
+  std::string error;
+  return pipeline.parse(spec, error);
+}
+
+int main() {
+  for(const char* spec : {"smallabs:0.1,0,0|lowpass:20Hz|envelope:50", "savgol:5,2,1", "madgwick:0.2", "hampel:5,2",
+                          "mahony:0.5,0.1", "tempo:64,16", "falls:0.3,3,10,50", "impacts:2,5", "motifs:2,8",
+                          "trajectory:20,0.001,10"}) {
+    CHECK(parses(spec));
+  }
+  // counts that are not integral, negative gains and thresholds
+  for(const char* spec : {"savgol:5.5,2", "stats:2.5", "median:0", "madgwick:-1", "mahony:0.5,-0.1", "hampel:5,-1",
+                          "small:0.1,-1,0", "motifs:1.5,8", "tempo:64,0", "impacts:-2", "lowpass:60",
+                          // a window of 0 divided by zero in the rolling statistics
+                          "trajectory:20,0.001,0", "trajectory:20,0.001,-1", "trajectory:-20,0.001,10"}) {
+    CHECK(!parses(spec));
+  }
+  return failures();
+}
@@ -0,0 +1,38 @@
+#include "check.hpp"
+#include "pipeline.hpp"
+
+int main() {
+  int up = 0, down = 0;
+  rationalRatio(0.5, up, down);
+  CHECK(up == 1 && down == 2);
+  rationalRatio(44.1 / 48, up, down);
+  CHECK(up == 147 && down == 160);
+  up = down = 0;
+  rationalRatio(std::nan(""), up, down);
+  CHECK(up == 1 && down == 1);
+
+  // stages appending columns after resample, which once indexed the history out of bounds
+  for(const char* spec : {"resample:50|stats:10", "resample:50|linear", "resample:30|savgol:5,2,1"}) {
+    Pipeline pipeline(100);
+    std::string error;
+    CHECK(pipeline.parse(spec, error));
+    SampleBlock block;
+    size_t outputs = 0;
+    for(int begin = 0; begin < 10 * blockLength; begin += blockLength) {
+      loadSamples(block, begin, blockLength, [](int, int c) { return c == zAcc ? 1. : 0.5; });
+      pipeline.process(block);
+      int mean = block.find("xAccelerationMean");
+      for(size_t i = 0; i < block.size(); ++i) {
+        CHECK_NEAR(block.columns[xAcc][i], 0.5, 1e-3);
+        CHECK_NEAR(block.columns[zAcc][i], 1, 1e-3);
+        if(mean >= 0 && isSet(block.valid[mean], i)) {
+          CHECK_NEAR(block.columns[mean][i], 0.5, 1e-3);
+        }
+      }
+      outputs += block.size();
+    }
+    pipeline.finish();
+    CHECK(outputs > 0);
+  }
+  return failures();
+}
@@ -0,0 +1,42 @@
+#include "check.hpp"
+#include "pipeline.hpp"
+
+int main() {
+  // the tabulated 5 point quadratic taps
+  auto smooth = savitzkyGolay(5, 2, 0);
+  auto derivative = savitzkyGolay(5, 2, 1);
+  CHECK(smooth.size() == 5 && derivative.size() == 5);
+  double smoothTaps[] = {-3, 12, 17, 12, -3}, derivativeTaps[] = {-2, -1, 0, 1, 2};
+  for(size_t j = 0; j < 5 && j < smooth.size() && j < derivative.size(); ++j) {
+    CHECK_NEAR(smooth[j], smoothTaps[j] / 35, 1e-12);
+    CHECK_NEAR(derivative[j], derivativeTaps[j] / 10, 1e-12);
+  }
+  CHECK(savitzkyGolay(4, 2, 0).empty());
+  CHECK(savitzkyGolay(5, 2, 3).empty());
+
+  // a quadratic passes the smoothing unchanged apart from the lag of half the window, the derivative
+  // of a ramp is its slope per second
+  auto quadratic = [](int t, int c) { return c == xAcc ? 1e-4 * t * t : 0.02 * t; };
+  for(int derivativeOrder : {0, 1}) {
+    Pipeline pipeline(100);
+    std::string error;
+    CHECK(pipeline.parse(derivativeOrder == 0 ? "savgol:5,2" : "savgol:9,3,1", error));
+    SampleBlock block;
+    for(int begin = 0; begin < 4 * blockLength; begin += blockLength) {
+      loadSamples(block, begin, blockLength, quadratic);
+      pipeline.process(block);
+      int slope = block.find(block.names[yAcc] + "Derivative");
+      CHECK((slope >= 0) == (derivativeOrder == 1));
+      for(size_t i = 8; i < block.size(); ++i) {
+        int t = block.t[i];
+        if(derivativeOrder == 1 && slope >= 0) {
+          CHECK_NEAR(block.columns[slope][i], 2, 1e-9);
+        } else if(derivativeOrder == 0) {
+          CHECK_NEAR(block.columns[xAcc][i], quadratic(t - 2, xAcc), 1e-9);
+          CHECK_NEAR(block.columns[yAcc][i], quadratic(t - 2, yAcc), 1e-9);
+        }
+      }
+    }
+  }
+  return failures();
+}
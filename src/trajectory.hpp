@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "orientation.hpp"
+#include "statistics.hpp"
+
+constexpr double gravity = 9.80665;  // m/s^2 per g
+
+// integrates linear acceleration to per stroke trajectories; the sensor counts as still (zero
+// velocity) while the rotation velocity magnitude stayed below maxRotation (deg/s) and the variance of
+// the acceleration magnitude below maxVariance (g^2) over the last window samples, a stroke is the
+// motion between two still periods; at the end of a stroke the velocity drift is removed linearly so
+// it ends at rest and its positions (m) and velocities (m/s) relative to its start are written to the
+// table, while streaming a stroke column holds the stroke index of every sample
+class TrajectoryStage : public Stage {
+  LinearAccelerationColumns linearAcceleration;
+  RollingStatistics<2> motion;  // rotation velocity magnitude, acceleration magnitude
+  double maxRotation, maxVariance, dt;
+  std::ofstream table;
+  int strokeColumn = -1;
+
+  bool inStroke = false;
+  int strokes = 0;
+  Vec3 lastAcceleration = {0, 0, 0};
+  std::vector<int> strokeT;
+  std::vector<Vec3> strokeAcceleration;
+
+  void finishStroke() {
+    size_t n = strokeAcceleration.size();
+    std::vector<Vec3> velocity(n);
+    Vec3 v = {0, 0, 0};
+    for(size_t i = 0; i < n; ++i) {
+      v = v + dt * strokeAcceleration[i];
+      velocity[i] = v;
+    }
+    Vec3 p = {0, 0, 0};
+    for(size_t i = 0; i < n; ++i) {
+      Vec3 corrected = velocity[i] - (double) (i + 1) / n * v;
+      p = p + dt * corrected;
+      table << strokes << "\t" << strokeT[i] << "\t" << p.x << "\t" << p.y << "\t" << p.z << "\t" << corrected.x
+            << "\t" << corrected.y << "\t" << corrected.z << "\n";
+    }
+    strokeT.clear();
+    strokeAcceleration.clear();
+    inStroke = false;
+  }
+
+public:
+  TrajectoryStage(const std::string& tableFile, double sampleRate, double maxRotation_, double maxVariance_, size_t window)
+      : motion(window), maxRotation(maxRotation_), maxVariance(maxVariance_), dt(1 / sampleRate), table(tableFile) {
+    table << "#stroke,t,xPosition,yPosition,zPosition,xVelocity,yVelocity,zVelocity" << std::endl;
+  }
+
+  void process(SampleBlock& block) override {
+    if(strokeColumn < 0) {
+      strokeColumn = block.column("stroke");
+    }
+    const int* linear = linearAcceleration(block);
+
+    for(size_t i = 0; i < block.size(); ++i) {
+      double x[2];
+      bool valid[2];
+      valid[0] = isSet(block.valid[xRot], i) && isSet(block.valid[yRot], i) && isSet(block.valid[zRot], i);
+      valid[1] = isSet(block.valid[xAcc], i) && isSet(block.valid[yAcc], i) && isSet(block.valid[zAcc], i);
+      x[0] = std::sqrt(squaredNorm(Vec3{block.columns[xRot][i], block.columns[yRot][i], block.columns[zRot][i]}));
+      x[1] = std::sqrt(squaredNorm(Vec3{block.columns[xAcc][i], block.columns[yAcc][i], block.columns[zAcc][i]}));
+      motion.push(x, valid);
+      bool still = motion.count(0) > 0 && motion.max(0) < maxRotation && motion.count(1) > 1 &&
+                   motion.variance(1) < maxVariance;
+
+      if(isSet(block.valid[linear[0]], i)) {
+        lastAcceleration = gravity * Vec3{block.columns[linear[0]][i], block.columns[linear[1]][i],
+                                          block.columns[linear[2]][i]};
+      }
+      if(still && inStroke) {
+        finishStroke();
+      } else if(!still) {
+        if(!inStroke) {
+          inStroke = true;
+          ++strokes;
+        }
+        strokeT.push_back(block.t[i]);
+        strokeAcceleration.push_back(lastAcceleration);
+      }
+      block.columns[strokeColumn][i] = strokes;
+      setBit(block.valid[strokeColumn], i, inStroke);
+    }
+  }
+
+  void finish() override {
+    if(inStroke) {
+      finishStroke();
+    }
+  }
+};
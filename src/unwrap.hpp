@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "block.hpp"
+#include "orientation.hpp"
+
+// removes the jumps of the angle channels where they wrap at +-180 degrees, in place, so filters and
+// derivatives see a continuous signal; every channel carries its last valid angle and its offset from
+// block to block; optionally adds the orientation as qw, qx, qy, qz columns, with the sign of every
+// quaternion chosen to be nearest to the one before so they are continuous as well
+class UnwrapStage : public Stage {
+  bool quaternion;
+  bool started[3] = {false, false, false};
+  double last[3], offset[3] = {0, 0, 0};
+  int outputs[4];
+  bool resolved = false;
+  double previous[4] = {1, 0, 0, 0};
+
+public:
+  UnwrapStage(bool quaternion_) : quaternion(quaternion_) {
+  }
+
+  void process(SampleBlock& block) override {
+    size_t n = block.size();
+    if(quaternion) {
+      if(!resolved) {
+        int k = 0;
+        for(const char* name : {"qw", "qx", "qy", "qz"}) {
+          outputs[k++] = block.column(name);
+        }
+        resolved = true;
+      }
+      // wrapped or not, the angles are the same rotation
+      eulerToQuaternions(block.columns[xAngle].data(), block.columns[yAngle].data(), block.columns[zAngle].data(), n,
+                         block.columns[outputs[0]].data(), block.columns[outputs[1]].data(),
+                         block.columns[outputs[2]].data(), block.columns[outputs[3]].data());
+      for(size_t w = 0; w < block.words(); ++w) {
+        uint64_t valid = block.valid[xAngle][w] & block.valid[yAngle][w] & block.valid[zAngle][w];
+        for(int output : outputs) {
+          block.valid[output][w] = valid;
+        }
+      }
+      for(size_t i = 0; i < n; ++i) {
+        if(!isSet(block.valid[outputs[0]], i)) {
+          continue;
+        }
+        double dot = 0;
+        for(int k = 0; k < 4; ++k) {
+          dot += previous[k] * block.columns[outputs[k]][i];
+        }
+        for(int k = 0; k < 4; ++k) {
+          block.columns[outputs[k]][i] *= dot < 0 ? -1 : 1;
+          previous[k] = block.columns[outputs[k]][i];
+        }
+      }
+    }
+
+    for(int c = 0; c < 3; ++c) {
+      double* angle = block.columns[xAngle + c].data();
+      const Mask& valid = block.valid[xAngle + c];
+      for(size_t i = 0; i < n; ++i) {
+        if(!isSet(valid, i)) {
+          continue;
+        }
+        if(!started[c]) {
+          last[c] = angle[i];
+          started[c] = true;
+        }
+        offset[c] -= 360 * std::round((angle[i] - last[c]) / 360);
+        last[c] = angle[i];
+        angle[i] += offset[c];
+      }
+    }
+  }
+};